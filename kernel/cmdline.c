@@ -0,0 +1,48 @@
+/*
+ * kernel options, given on the command line between the PKE kernel and the application,
+ * in the form of "--name=value", e.g.:
+ *   spike obj/riscv-pke --nproc=64 obj/app_shell
+ */
+
+#include "cmdline.h"
+#include "util/types.h"
+#include "util/string.h"
+#include "spike_interface/spike_htif.h"
+#include "spike_interface/spike_utils.h"
+
+// command line as returned by HTIFSYS_getmainvars: argc, argv[], then the strings
+static uint64 g_cmdline[64];
+static int g_cmdline_loaded = 0;
+
+//
+// returns the value of kernel option "--name=value", or NULL if it is not given.
+//
+const char *cmdline_option(const char *name) {
+  if (!g_cmdline_loaded) {
+    long r = frontend_syscall(HTIFSYS_getmainvars, (uint64)g_cmdline, sizeof(g_cmdline),
+        0, 0, 0, 0, 0);
+    kassert(r == 0);
+    g_cmdline_loaded = 1;
+  }
+
+  size_t len = strlen(name);
+  // skip the PKE OS kernel string, options end at the application name
+  for (uint64 i = 1; i < g_cmdline[0]; i++) {
+    const char *arg = (const char *)g_cmdline[1 + i];
+    if (arg[0] != '-' || arg[1] != '-') break;
+
+    arg += 2;
+    int match = 1;
+    for (size_t j = 0; j < len && match; j++) match = arg[j] == name[j];
+    if (match && arg[len] == '=') return arg + len + 1;
+  }
+  return NULL;
+}
+
+//
+// returns the numeric value of kernel option "--name=N", or default_value.
+//
+long cmdline_option_long(const char *name, long default_value) {
+  const char *value = cmdline_option(name);
+  return value ? atol(value) : default_value;
+}
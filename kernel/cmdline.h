@@ -0,0 +1,7 @@
+#ifndef _CMDLINE_H_
+#define _CMDLINE_H_
+
+const char *cmdline_option(const char *name);
+long cmdline_option_long(const char *name, long default_value);
+
+#endif
@@ -1,10 +1,14 @@
 #ifndef _CONFIG_H_
 #define _CONFIG_H_
 
-// we use only one HART (cpu) in fundamental experiments
-#define NCPU 1
+// number of HARTs (cpus) the kernel boots, run spike with -p<N> to give it N of them.
+// harts the emulator has beyond NCPU are parked, NCPU beyond the emulated ones are unused
+#define NCPU 4
 
-//interval of timer interrupt
+// frequency of the mtime counter (and the time csr) of spike, in Hz
+#define TIMEBASE_FREQ 10000000
+
+//interval of timer interrupt, i.e., length of a tick (100ms)
 #define TIMER_INTERVAL 1000000
 
 // the maximum memory space that PKE is allowed to manage
@@ -13,4 +17,34 @@
 // the ending physical address that PKE observes
 #define PHYS_TOP (DRAM_BASE + PKE_MAX_ALLOWABLE_RAM)
 
+// largest leaf page used by the kernel direct map, wherever alignment allows:
+// 0 for 4KB pages only, 1 for 2MB megapages, 2 for 1GB gigapages
+#define KERN_MAP_MAX_LEVEL 2
+
+// bring free memory into the physical memory manager one 4MB section at a time, when
+// it is first needed, instead of initializing every page at boot
+#define PMM_LAZY_INIT 1
+
+// with PMM_LAZY_INIT, also initialize the remaining sections in the background, on idle
+// harts and one section per timer interrupt
+#define PMM_DEFERRED_INIT 1
+
+// take the timer ticks that do not preempt the running process in smode_trap_vector,
+// without saving the user registers or switching to the kernel page table
+#define TIMER_FAST_PATH 1
+
+// map the kernel (text, data and direct map) into every user page table, as global
+// pages without PTE_U, so that traps stay on the page table of the process instead of
+// switching satp to the kernel page table and back. 0 keeps the kernel out of user page
+// tables, but for the trapframe and the trap vector
+#define KERNEL_IN_USER_PT 1
+
+// load ELF segments on demand: a page is read from the host file on its first access,
+// instead of reading every segment in full before the program starts
+#define ELF_DEMAND_PAGING 1
+
+// scheduling policy, "rr" (round-robin), "mlfq" (multi-level feedback queue) or "cfs"
+// (fair share by nice value). the kernel option --sched= selects another one at boot
+#define SCHED_POLICY "rr"
+
 #endif
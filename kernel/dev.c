@@ -1,6 +1,7 @@
 #include "dev.h"
 #include "vfs.h"
 #include "pmm.h"
+#include "slab.h"
 #include "riscv.h"
 #include "util/types.h"
 #include "util/string.h"
@@ -9,6 +10,10 @@
 // global RAMDISK0 BASE ADDRESS
 void * RAMDISK0_BASE_ADDR;
 
+// object caches of device entries
+static struct kmem_cache * vdev_cachep;
+static struct kmem_cache * device_cachep;
+
 //
 // 从 buffer 中获取数据，写入第 blkno 块
 // buffer -> RAM Disk0[blkno] (data size: 1 block)
@@ -43,7 +48,7 @@ int ramdisk0_output(void * buffer, int blkno){
   *      fs:       the file system mounted to the device, initialized by vfs_mount (vfs.h)
   */
 void dev_init_ramdisk0(void) {
-  struct vfs_dev_t * pdev = (struct vfs_dev_t *)alloc_page();
+  struct vfs_dev_t * pdev = (struct vfs_dev_t *)kmem_cache_alloc(vdev_cachep);
   // 1. set the device name and index
   pdev->devname   = "ramdisk0";
   pdev->listidx   = RAMDISK0;
@@ -58,7 +63,7 @@ void dev_init_ramdisk0(void) {
    *        d_input:      device input funtion
    *        d_output:     device output funtion
    */
-  struct device * pd = (struct device *)alloc_page();
+  struct device * pd = (struct device *)kmem_cache_alloc(device_cachep);
   pd->d_blocks    = RAMDISK0_BLOCK;
   pd->d_blocksize = RAMDISK0_BSIZE;
   pd->d_input     = ramdisk0_input;
@@ -71,19 +76,22 @@ void dev_init_ramdisk0(void) {
 }
 
 //
-// alloc space (RAMDISK0_BLOCK*RAMDISK0_BSIZE Bytes) for the RAM Disk
+// alloc space (RAMDISK0_BLOCK*RAMDISK0_BSIZE Bytes) for the RAM Disk, as one physically
+// contiguous block
 //
 void init_ramdisk0(void){
-  int alloc_times = (RAMDISK0_BLOCK*RAMDISK0_BSIZE-1) / PGSIZE + 1;
-  for ( int i = 0; i < alloc_times; ++ i ){
-    RAMDISK0_BASE_ADDR = alloc_page();
-  }
+  RAMDISK0_BASE_ADDR = alloc_pages(get_order(RAMDISK0_BLOCK*RAMDISK0_BSIZE));
+  if ( RAMDISK0_BASE_ADDR == NULL )
+    panic("RAM Disk0: cannot allocate contiguous space for the disk!\n");
 }
 
 //
 // Initialize devices
 //
 void dev_init(void) {
+  vdev_cachep   = kmem_cache_create("vfs_dev", sizeof(struct vfs_dev_t), NULL);
+  device_cachep = kmem_cache_create("device", sizeof(struct device), NULL);
+
   init_ramdisk0();      // alloc space for RAM Disk0
   dev_init_ramdisk0();  // add the device entry to vfs_dev_list
 }
@@ -8,9 +8,13 @@
 #include "riscv.h"
 #include "vmm.h"
 #include "pmm.h"
+#include "config.h"
+#include "slab.h"
+#include "util/functions.h"
 #include "spike_interface/spike_utils.h"
 
 #define MAXARGS 10
+#define MAXARGLEN 64
 
 typedef struct elf_info_t {
   spike_file_t *f;
@@ -18,20 +22,27 @@ typedef struct elf_info_t {
 } elf_info;
 
 //
-// the implementation of allocater. allocates memory space for later segment loading
+// the implementation of allocater. allocates memory space for later segment loading.
+// a segment may span several pages and need not start on a page boundary, so it is
+// backed by one physically contiguous buddy block and can be loaded with a single read.
+// returns the (physical) address where the byte at elf_va is to be placed.
 //
 static void *elf_alloc_mb(elf_ctx *ctx, uint64 elf_pa, uint64 elf_va, uint64 size) {
   elf_info *msg = (elf_info *)ctx->info;
-  // We assume that size of proram segment is smaller than a page.
-  kassert(size < PGSIZE);
-  void *pa = alloc_page();
+  uint64 va_start = ROUNDDOWN(elf_va, PGSIZE);
+  uint64 npages = (ROUNDUP(elf_va + size, PGSIZE) - va_start) / PGSIZE;
+  int order = get_order(npages * PGSIZE);
+
+  void *pa = alloc_pages(order);
   if (pa == 0) panic("uvmalloc mem alloc falied\n");
+  // give the tail of the buddy block that the segment does not use back to the allocator
+  for (uint64 i = npages; i < (1UL << order); i++) free_page(pa + i * PGSIZE);
 
-  memset((void *)pa, 0, PGSIZE);
-  user_vm_map((pagetable_t)msg->p->pagetable, elf_va, PGSIZE, (uint64)pa,
+  memset((void *)pa, 0, npages * PGSIZE);
+  user_vm_map((pagetable_t)msg->p->mm->pagetable, va_start, npages * PGSIZE, (uint64)pa,
          prot_to_type(PROT_WRITE | PROT_READ | PROT_EXEC, 1));
 
-  return pa;
+  return pa + (elf_va - va_start);
 }
 
 //
@@ -59,7 +70,8 @@ elf_status elf_init(elf_ctx *ctx, void *info) {
 }
 
 //
-// load the elf segments to memory regions
+// load the elf segments to memory regions. with ELF_DEMAND_PAGING, the segments are
+// only recorded here, and their pages are read in by elf_demand_fault.
 //
 elf_status elf_load(elf_ctx *ctx) {
   elf_prog_header ph_addr;
@@ -73,35 +85,116 @@ elf_status elf_load(elf_ctx *ctx) {
     if (ph_addr.memsz < ph_addr.filesz) return EL_ERR;
     if (ph_addr.vaddr + ph_addr.memsz < ph_addr.vaddr) return EL_ERR;
 
+#if !ELF_DEMAND_PAGING
     // allocate memory before loading
     void *dest = elf_alloc_mb(ctx, ph_addr.vaddr, ph_addr.vaddr, ph_addr.memsz);
 
-    // actual loading
-    if (elf_fpread(ctx, dest, ph_addr.memsz, ph_addr.off) != ph_addr.memsz)
+    // actual loading. the part beyond filesz (bss) stays zero-filled.
+    if (elf_fpread(ctx, dest, ph_addr.filesz, ph_addr.off) != ph_addr.filesz)
       return EL_EIO;
+#endif
 
-    // record the vm region in proc->mapped_info
+    // record the vm region in proc->mm->mapped_info
     int j;
     for( j=0; j<PGSIZE/sizeof(mapped_region); j++ )
-      if( (process*)(((elf_info*)(ctx->info))->p)->mapped_info[j].va == 0x0 ) break;
-
-    ((process*)(((elf_info*)(ctx->info))->p))->mapped_info[j].va = ph_addr.vaddr;
-    ((process*)(((elf_info*)(ctx->info))->p))->mapped_info[j].npages = 1;
+      if( (process*)(((elf_info*)(ctx->info))->p)->mm->mapped_info[j].va == 0x0 ) break;
+
+    ((process*)(((elf_info*)(ctx->info))->p))->mm->mapped_info[j].va = ROUNDDOWN(ph_addr.vaddr, PGSIZE);
+    ((process*)(((elf_info*)(ctx->info))->p))->mm->mapped_info[j].npages =
+      (ROUNDUP(ph_addr.vaddr + ph_addr.memsz, PGSIZE) - ROUNDDOWN(ph_addr.vaddr, PGSIZE)) / PGSIZE;
+    ((process*)(((elf_info*)(ctx->info))->p))->mm->mapped_info[j].file_va = ph_addr.vaddr;
+    ((process*)(((elf_info*)(ctx->info))->p))->mm->mapped_info[j].file_off = ph_addr.off;
+    ((process*)(((elf_info*)(ctx->info))->p))->mm->mapped_info[j].file_sz = ph_addr.filesz;
     if( ph_addr.flags == (SEGMENT_READABLE|SEGMENT_EXECUTABLE) ){
-      ((process*)(((elf_info*)(ctx->info))->p))->mapped_info[j].seg_type = CODE_SEGMENT;
+      ((process*)(((elf_info*)(ctx->info))->p))->mm->mapped_info[j].seg_type = CODE_SEGMENT;
       sprint( "CODE_SEGMENT added at mapped info offset:%d\n", j );
     }else if ( ph_addr.flags == (SEGMENT_READABLE|SEGMENT_WRITABLE) ){
-      ((process*)(((elf_info*)(ctx->info))->p))->mapped_info[j].seg_type = DATA_SEGMENT;
+      ((process*)(((elf_info*)(ctx->info))->p))->mm->mapped_info[j].seg_type = DATA_SEGMENT;
       sprint( "DATA_SEGMENT added at mapped info offset:%d\n", j );
     }else
       panic( "unknown program segment encountered, segment flag:%d.\n", ph_addr.flags );
 
-    ((process*)(((elf_info*)(ctx->info))->p))->total_mapped_region ++;
+    ((process*)(((elf_info*)(ctx->info))->p))->mm->total_mapped_region ++;
   }
 
   return EL_OK;
 }
 
+//
+// fault in the page at va of a demand-paged ELF segment of process p: the part of the
+// page that the segment has in the file is read from there, the rest is zero-filled.
+// returns 0 on success, -1 if va does not belong to a segment, or is already present.
+//
+int elf_demand_fault(process *p, uint64 va) {
+  if (p->mm->exec_file == 0) return -1;
+  spike_file_t *f = p->mm->exec_file->f;
+
+  uint64 page_va = ROUNDDOWN(va, PGSIZE);
+  if (lookup_pa(p->mm->pagetable, page_va) != 0) return -1;
+
+  for (int i = 0; i < p->mm->total_mapped_region; i++) {
+    mapped_region *r = &p->mm->mapped_info[i];
+    if (r->seg_type != CODE_SEGMENT && r->seg_type != DATA_SEGMENT) continue;
+    if (page_va < r->va || page_va >= r->va + (uint64)r->npages * PGSIZE) continue;
+
+    void *pa = alloc_page();
+    if (pa == 0) panic("elf_demand_fault: out of memory.\n");
+    memset(pa, 0, PGSIZE);
+
+    uint64 start = MAX(page_va, r->file_va);
+    uint64 end = MIN(page_va + PGSIZE, r->file_va + r->file_sz);
+    if (start < end &&
+        spike_file_pread(f, pa + (start - page_va), end - start,
+          r->file_off + (start - r->file_va)) != end - start)
+      panic("elf_demand_fault: fail on reading the elf file.\n");
+
+    int prot = r->seg_type == CODE_SEGMENT ? PROT_READ | PROT_EXEC : PROT_READ | PROT_WRITE;
+    user_vm_map(p->mm->pagetable, page_va, PGSIZE, (uint64)pa, prot_to_type(prot, 1));
+    return 0;
+  }
+
+  return -1;
+}
+
+// object cache of the exec_files of demand-paged address spaces
+static struct kmem_cache *exec_file_cachep;
+
+void elf_file_init(void) {
+  exec_file_cachep = kmem_cache_create("exec_file", sizeof(exec_file), NULL);
+}
+
+//
+// make the host file f, just opened and loaded into mm, the file mm pages in from.
+//
+static void elf_keep_file(mm_struct *mm, spike_file_t *f) {
+  exec_file *ef = (exec_file *)kmem_cache_alloc(exec_file_cachep);
+  if (ef == 0) panic("elf_keep_file: out of memory.\n");
+  ef->f = f;
+  ef->owners = 1;
+  mm->exec_file = ef;
+}
+
+//
+// a forked child pages in the rest of its segments from the parent's file.
+//
+void elf_share_file(mm_struct *child, mm_struct *parent) {
+  child->exec_file = parent->exec_file;
+  if (child->exec_file) child->exec_file->owners++;
+}
+
+//
+// drop mm from the owners of its host ELF file, which the last owner closes.
+//
+void elf_release_file(mm_struct *mm) {
+  exec_file *ef = mm->exec_file;
+  if (ef == 0) return;
+  mm->exec_file = 0;
+  if (--ef->owners > 0) return;
+
+  spike_file_close(ef->f);
+  kmem_cache_free(exec_file_cachep, ef);
+}
+
 typedef union {
   uint64 buf[MAX_CMDLINE_ARGS];
   char *argv[MAX_CMDLINE_ARGS];
@@ -121,6 +214,10 @@ static size_t parse_args(arg_buf *arg_bug_msg) {
   uint64 *pk_argv = &arg_bug_msg->buf[1];
 
   int arg = 1;  // skip the PKE OS kernel string, leave behind only the application name
+  // also skip the kernel options (see cmdline.c) in front of the application name
+  while (arg < pk_argc && ((char *)(uintptr_t)pk_argv[arg])[0] == '-' &&
+         ((char *)(uintptr_t)pk_argv[arg])[1] == '-')
+    arg++;
   for (size_t i = 0; arg + i < pk_argc; i++)
     arg_bug_msg->argv[i] = (char *)(uintptr_t)pk_argv[arg + i];
 
@@ -158,8 +255,13 @@ void load_bincode_from_host_elf(struct process *p) {
   // entry (virtual) address
   p->trapframe->epc = elfloader.ehdr.entry;
 
+#if ELF_DEMAND_PAGING
+  // keep the host file open, the segments are paged in from it
+  elf_keep_file(p->mm, info.f);
+#else
   // close host file
   spike_file_close( info.f );
+#endif
 
   sprint("sp in load bincode: %p\n", p->trapframe->regs.sp);
 
@@ -167,25 +269,55 @@ void load_bincode_from_host_elf(struct process *p) {
 }
 
 //
-// load the elf of shell commands
+// the arguments of a shell command, copied in from the process that runs it
 //
-void load_shell_bincode_from_host_elf(char ** argv){
-  // 1. specify the path of the shell command object
-  char path[30] = "./obj/";
-  strcat(path, user_va_to_pa(current->pagetable, argv[0]));
-  sprint("Shell application: %s\n", path);
-
-  // 2. re-alloc the current process
-  // 2.1. save old argv
-  char * oldargv[MAXARGS+1];
+typedef struct shell_args_t {
   int argc;
-  for ( argc = 0; user_va_to_pa(current->pagetable, argv[argc])!=0; ++ argc ){
-    oldargv[argc] = user_va_to_pa(current->pagetable, argv[argc]);
+  char * argv[MAXARGS+1];
+  char buf[MAXARGS][MAXARGLEN];
+  char path[30];  // the object of the command, under ./obj
+} shell_args;
+
+//
+// copy in the arguments of a shell command from current process, whose argv array is
+// at the user address argv. returns argc, or -1 if there is no command, an argument is
+// not user memory of current process or is too long, or the command name is too long.
+//
+static int shell_command_args(uint64 argv, shell_args * a){
+  for ( a->argc = 0; a->argc < MAXARGS; ++ a->argc ){
+    uint64 arg;
+    if ( copyin(current, &arg, argv + a->argc * sizeof(uint64), sizeof(arg)) != 0 ) return -1;
+    if ( arg == 0 ) break;
+    if ( copyinstr(current, a->buf[a->argc], arg, MAXARGLEN) < 0 ) return -1;
+    a->argv[a->argc] = a->buf[a->argc];
   }
-  oldargv[argc] = 0;
-  // 2.2. reallocate the process
-  realloc_process(current->pid);
-  // 2.3. load the arguments
+  a->argv[a->argc] = 0;
+  if ( a->argc == 0 || strlen("./obj/") + strlen(a->argv[0]) >= sizeof(a->path) ) return -1;
+
+  strcpy(a->path, "./obj/");
+  strcat(a->path, a->argv[0]);
+  return a->argc;
+}
+
+//
+// load the shell command object at path into p, and pass it args (argc of them, in
+// kernel-accessible memory) on its user stack. returns -1 if there is no such object or
+// it is not a valid elf, in which case p may hold part of it and is to be released.
+//
+static int load_shell_command(process * p, char * path, int argc, char * args[]){
+  elf_ctx elfloader;
+  elf_info info;
+
+  info.f = spike_file_open(path, O_RDONLY, 0);
+  info.p = p;
+  if (IS_ERR_VALUE(info.f)) return -1;
+
+  // init elfloader, and load elf
+  if (elf_init(&elfloader, &info) != EL_OK || elf_load(&elfloader) != EL_OK){
+    spike_file_close( info.f );
+    return -1;
+  }
+
   // ustack example ///////
   // [0x7fffeff8] echo
   // [0x7fffeff0] a
@@ -194,48 +326,73 @@ void load_shell_bincode_from_host_elf(char ** argv){
   // [0x7fffefd8] 0x7fffeff0
   // [0x7fffefd0] 0x7fffeff8
   // //////////////////////
-  // build ustack for argv
-  void * sp = (void *)current->trapframe->regs.sp;
+  // build ustack for argv, each string in as many 8-byte slots as it needs
+  void * sp = (void *)p->trapframe->regs.sp;
+  uint64 uargv[MAXARGS+1];
 
   for ( int i = 0; i <= argc; ++ i ){
-    sp -= 8;
     if ( i != argc ){
-      strcpy(user_va_to_pa(current->pagetable, sp), oldargv[i]);
+      sp -= ROUNDUP(strlen(args[i]) + 1, 8);
+      strcpy(user_va_to_pa(p->mm->pagetable, sp), args[i]);
     }else{  // add 0
-      *(uint64*)user_va_to_pa(current->pagetable, sp) = (uint64)oldargv[i];
+      sp -= 8;
+      *(uint64*)user_va_to_pa(p->mm->pagetable, sp) = 0;
     }
-    oldargv[i] = sp;
+    uargv[i] = (uint64)sp;
   }
   // build ustack pointer for argv
   for ( int i = 0; i <= argc; ++ i ){
     sp -= 8;
-    *(uint64*)user_va_to_pa(current->pagetable, sp) = (uint64)oldargv[argc-i];
+    *(uint64*)user_va_to_pa(p->mm->pagetable, sp) = uargv[argc-i];
   }
-  current->trapframe->regs.sp = (uint64)sp;
-  current->trapframe->regs.a0 = argc;  // main function arg number
-  current->trapframe->regs.a1 = (uint64)sp;
-  
-  // 3. load bincode from host elf
-  // elf loading
-  elf_ctx elfloader;
-  elf_info info;
-
-  info.f = spike_file_open(path, O_RDONLY, 0);
-  info.p = current;
-  if (IS_ERR_VALUE(info.f)) panic("Fail on openning the input application program.\n");
-
-  // init elfloader
-  if (elf_init(&elfloader, &info) != EL_OK)
-    panic("fail to init elfloader.\n");
-
-  // load elf
-  if (elf_load(&elfloader) != EL_OK) panic("Fail on loading elf.\n");
+  p->trapframe->regs.sp = (uint64)sp;
+  p->trapframe->regs.a0 = argc;  // main function arg number
+  p->trapframe->regs.a1 = (uint64)sp;
 
   // entry (virtual) address
-  current->trapframe->epc = elfloader.ehdr.entry;
+  p->trapframe->epc = elfloader.ehdr.entry;
 
+#if ELF_DEMAND_PAGING
+  // keep the host file open, the segments are paged in from it
+  elf_keep_file(p->mm, info.f);
+#else
   // close host file
   spike_file_close( info.f );
+#endif
+
+  sprint("Application program entry point (virtual address): 0x%lx\n", p->trapframe->epc);
+  return 0;
+}
+
+//
+// load the elf of shell commands. argv is the user address of the argv array of current
+// process. returns -1, with current process left as it is, if the arguments cannot be
+// copied in.
+//
+int load_shell_bincode_from_host_elf(uint64 argv){
+  // 1. specify the path of the shell command object, and copy in argv
+  shell_args args;
+  if ( shell_command_args(argv, &args) < 0 ) return -1;
+  sprint("Shell application: %s\n", args.path);
 
-  sprint("Application program entry point (virtual address): 0x%lx\n", current->trapframe->epc);
-}
\ No newline at end of file
+  // 2. re-alloc the current process
+  realloc_process(current->pid);
+
+  // 3. load bincode from host elf, with the arguments
+  if ( load_shell_command(current, args.path, args.argc, args.argv) != 0 )
+    panic("Fail on loading elf.\n");
+  return 0;
+}
+
+//
+// load the elf of the shell command whose argv array is at the user address argv of
+// current process into p, a newly allocated process, for spawn. returns -1 if the
+// command cannot be loaded.
+//
+int spawn_shell_bincode_from_host_elf(process * p, uint64 argv){
+  shell_args args;
+  if ( shell_command_args(argv, &args) < 0 ) return -1;
+  sprint("Spawn application: %s\n", args.path);
+
+  return load_shell_command(p, args.path, args.argc, args.argv);
+}
@@ -55,6 +55,13 @@ typedef enum elf_status_t {
 
 } elf_status;
 
+// a host ELF file that demand-paged address spaces read their segments from. the address
+// spaces forked from one another share it, and the last of its owners closes it.
+typedef struct exec_file_t {
+  struct file_t *f;
+  int owners;
+} exec_file;
+
 typedef struct elf_ctx_t {
   void *info;
   elf_header ehdr;
@@ -64,6 +71,12 @@ elf_status elf_init(elf_ctx *ctx, void *info);
 elf_status elf_load(elf_ctx *ctx);
 
 void load_bincode_from_host_elf(process *p);
-void load_shell_bincode_from_host_elf(char ** argv);
+int load_shell_bincode_from_host_elf(uint64 argv);
+int spawn_shell_bincode_from_host_elf(process * p, uint64 argv);
+
+void elf_file_init(void);
+int elf_demand_fault(process *p, uint64 va);
+void elf_share_file(mm_struct *child, mm_struct *parent);
+void elf_release_file(mm_struct *mm);
 
 #endif
@@ -3,6 +3,7 @@
 #include "dev.h"
 #include "rfs.h"
 #include "pmm.h"
+#include "slab.h"
 #include "riscv.h"
 #include "process.h"
 #include "util/functions.h"
@@ -13,7 +14,12 @@
 // Access to the RAM Disk
 // ///////////////////////////////////
 
+// object cache of files_structs
+static struct kmem_cache * files_cachep;
+
 void fs_init(void){
+  files_cachep = kmem_cache_create("files_struct", sizeof(struct files_struct), NULL);
+  vfs_init();
   dev_init();
   rfs_init();
 }
@@ -109,7 +115,9 @@ int do_close(int fd){
  *      nfile:    * of opened files for current process
  */
 struct files_struct * files_create(void){
-  struct files_struct * pfiles = (struct files_struct *)alloc_page();
+  struct files_struct * pfiles = (struct files_struct *)kmem_cache_alloc(files_cachep);
+  if ( pfiles == NULL )
+    panic("files_create: out of memory!\n");
   pfiles->cwd   = NULL; // 将进程打开的第一个文件的目录作为进程的cwd
   pfiles->nfile = 0;
   // save file entries for spike files
@@ -142,7 +150,7 @@ struct files_struct * files_create(void){
 // destroy a files_struct for a process
 //
 void files_destroy(struct files_struct * pfiles){
-  free_page(pfiles);
+  kmem_cache_free(files_cachep, pfiles);
   return;
 }
 
@@ -60,7 +60,4 @@ struct files_struct {
 struct files_struct * files_create(void);
 void files_destroy(struct files_struct * pfiles);
 
-// current running process
-extern process* current;
-
 #endif
@@ -0,0 +1,75 @@
+/*
+ * lazy floating-point context switching. the F/D registers of a hart hold the state of
+ * one process, the fp_owner of the hart, and a process runs with sstatus.FS Off unless
+ * they hold its state. its first FP instruction then traps as an illegal instruction,
+ * and fp_trap loads its state. the state is saved back, when the process leaves the
+ * hart, only if the process has written the registers (FS Dirty). processes that do not
+ * use the FPU never save or load anything.
+ */
+
+#include "fp.h"
+#include "riscv.h"
+#include "spike_interface/spike_utils.h"
+
+void fp_save_regs(fp_state* fp);
+void fp_restore_regs(const fp_state* fp);
+
+static inline uint64 fp_get_fs(void) { return read_csr(sstatus) & SSTATUS_FS; }
+
+static inline void fp_set_fs(uint64 fs) {
+  write_csr(sstatus, (read_csr(sstatus) & ~SSTATUS_FS) | fs);
+}
+
+// do the FP registers of this hart hold the state of p?
+static inline int fp_is_live(process* p) {
+  return g_cpus[cpuid()].fp_owner == p && p->fp_cpu == cpuid();
+}
+
+//
+// p is about to run in user mode on this hart (switch_to): let it use the FPU only if the
+// registers of the hart hold its state.
+//
+void fp_enter(process* p) {
+  if (!fp_is_live(p))
+    fp_set_fs(SSTATUS_FS_OFF);
+  else if (fp_get_fs() == SSTATUS_FS_OFF)
+    fp_set_fs(SSTATUS_FS_CLEAN);
+}
+
+//
+// the process that ran on this hart leaves it (schedule): save its FP state if it wrote
+// the registers. the registers keep the state, in case it comes back to this hart.
+//
+void fp_leave(void) {
+  if (fp_get_fs() == SSTATUS_FS_DIRTY) fp_save_regs(&g_cpus[cpuid()].fp_owner->fp);
+  fp_set_fs(SSTATUS_FS_OFF);
+}
+
+//
+// bring the FP state of p, running on this hart, up to date in p->fp (for fork).
+//
+void fp_flush(process* p) {
+  if (fp_is_live(p) && fp_get_fs() == SSTATUS_FS_DIRTY) {
+    fp_save_regs(&p->fp);
+    fp_set_fs(SSTATUS_FS_CLEAN);
+  }
+}
+
+//
+// handle an illegal instruction of p. if the FPU was off, the instruction may be the first
+// FP one of p since it was switched to: load the state of p and let the instruction run
+// again. returns -1 if the instruction is illegal with the FPU on.
+//
+int fp_trap(process* p) {
+  if (fp_get_fs() != SSTATUS_FS_OFF) return -1;
+
+  fp_set_fs(SSTATUS_FS_INITIAL);
+  if (!fp_is_live(p)) {
+    // the state of the previous owner was saved when it left this hart
+    fp_restore_regs(&p->fp);
+    g_cpus[cpuid()].fp_owner = p;
+    p->fp_cpu = cpuid();
+  }
+  fp_set_fs(SSTATUS_FS_CLEAN);
+  return 0;
+}
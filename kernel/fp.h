@@ -0,0 +1,11 @@
+#ifndef _FP_H_
+#define _FP_H_
+
+#include "process.h"
+
+void fp_enter(process* p);
+void fp_leave(void);
+void fp_flush(process* p);
+int fp_trap(process* p);
+
+#endif
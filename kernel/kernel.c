@@ -10,7 +10,11 @@
 #include "vmm.h"
 #include "file.h"
 #include "sched.h"
+#include "timer.h"
+#include "kinfo.h"
 #include "memlayout.h"
+#include "cmdline.h"
+#include "smp.h"
 #include "spike_interface/spike_utils.h"
 
 //
@@ -19,6 +23,9 @@
 //
 extern char trap_sec_start[];
 
+// set by hart 0 once the kernel is initialized, the other harts wait for it in s_start
+static volatile int g_kernel_ready = 0;
+
 //
 // turn on paging.
 //
@@ -45,10 +52,32 @@ process* load_user_program( ) {
   return proc;
 }
 
+//
+// s_start_secondary: S-mode entry point of the harts other than hart 0. they join in
+// scheduling once hart 0 has built the kernel.
+//
+static void s_start_secondary(void) {
+  while (!g_kernel_ready)
+    ;
+  __sync_synchronize();
+
+  enable_paging();
+  write_csr(scounteren, COUNTEREN_CY | COUNTEREN_TM | COUNTEREN_IR);
+
+  kernel_lock();
+  g_cpus[cpuid()].online = 1;
+  schedule();
+}
+
 //
 // s_start: S-mode entry point of PKE OS kernel.
 //
 int s_start(void) {
+  // sscratch is 0 while the kernel runs, how smode_trap_vector tells its own traps
+  write_csr(sscratch, 0);
+  if (cpuid() != 0) s_start_secondary();
+
+  kernel_lock();
   sprint("Enter supervisor mode...\n");
   // in the beginning, we use Bare mode (direct) memory mapping as in lab1,
   // but now switch to paging mode in lab2.
@@ -64,7 +93,21 @@ int s_start(void) {
   enable_paging();
   sprint("kernel page table is on \n");
 
-  init_proc_pool();
+  // user address spaces are tagged with ASIDs, the kernel's one is 0
+  asid_init();
+
+  // let user programs read the cycle, time and instret counters
+  write_csr(scounteren, COUNTEREN_CY | COUNTEREN_TM | COUNTEREN_IR);
+
+  // kernel stacks of the harts
+  smp_init();
+  g_cpus[cpuid()].online = 1;
+
+  init_proc_pool( cmdline_option_long("nproc", NPROC) );
+  elf_file_init();
+  sched_init();
+  timer_init( g_nproc );
+  kinfo_init();
 
   // init RAM Disk
   fs_init();
@@ -72,6 +115,10 @@ int s_start(void) {
   // the application code (elf) is first loaded into memory, and then put into execution
   sprint("Switch to user mode...\n");
   insert_to_ready_queue( load_user_program() );
+
+  // let the other harts in
+  __sync_synchronize();
+  g_kernel_ready = 1;
   schedule();
 
   return 0;
@@ -0,0 +1,93 @@
+/*
+ * the kernel info page, see kinfo.h. the kernel updates the entry of a process whenever
+ * it changes status, or is charged the ticks it ran. the page itself is shared by all
+ * processes.
+ */
+
+#include "kinfo.h"
+#include "process.h"
+#include "sched.h"
+#include "timer.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "memlayout.h"
+#include "util/string.h"
+#include "spike_interface/spike_utils.h"
+
+_Static_assert(sizeof(kinfo) <= PGSIZE, "the kernel info page overflows");
+_Static_assert(KINFO_FREE == FREE && KINFO_READY == READY && KINFO_RUNNING == RUNNING &&
+               KINFO_BLOCKED == BLOCKED && KINFO_ZOMBIE == ZOMBIE,
+               "the kernel info page exports the process status as is");
+
+// g_mem_size is defined in spike_interface/spike_memory.c, the size of the memory
+extern uint64 g_mem_size;
+
+static kinfo* g_kinfo = NULL;
+
+void kinfo_init(void) {
+  g_kinfo = (kinfo*)alloc_page();
+  if (g_kinfo == NULL) panic("kinfo_init: cannot allocate the kernel info page.\n");
+  memset(g_kinfo, 0, PGSIZE);
+  g_kinfo->timebase_freq = TIMEBASE_FREQ;
+  g_kinfo->mem_size = g_mem_size;
+  safestrcpy(g_kinfo->sched_policy, sched_policy(), sizeof(g_kinfo->sched_policy));
+}
+
+//
+// map the kernel info page read-only into the address space of p.
+//
+void kinfo_map(process* p) {
+  user_vm_map(p->mm->pagetable, USER_KINFO_VA, PGSIZE, (uint64)g_kinfo,
+              prot_to_type(PROT_READ, 1));
+}
+
+// the process count of the page for status, NULL for FREE
+static int32* kinfo_count(kinfo* k, int status) {
+  switch (status) {
+    case READY:   return &k->nr_ready;
+    case RUNNING: return &k->nr_running;
+    case BLOCKED: return &k->nr_blocked;
+    case ZOMBIE:  return &k->nr_zombie;
+  }
+  return NULL;
+}
+
+//
+// write the current statistics of process p to the page, counting a context switch if
+// switched is set. the counts by status are running totals, moved from the status p was
+// last counted under to its current one. called with the kernel lock held, so there is a
+// single writer.
+//
+void kinfo_update(process* p, int switched) {
+  kinfo* k = g_kinfo;
+  int i = p - procs;
+
+  k->seq++;
+  __sync_synchronize();
+
+  k->nr_switches += switched;
+  k->ticks = g_ticks;
+  k->mtime = timer_now();
+
+  if (p->status != p->kinfo_status) {
+    int32* n = kinfo_count(k, p->kinfo_status);
+    if (n) (*n)--;
+    if ((n = kinfo_count(k, p->status))) (*n)++;
+    p->kinfo_status = p->status;
+  }
+
+  if (i < KINFO_MAX_PROCS) {
+    if (i >= k->nproc) k->nproc = i + 1;
+    kinfo_proc* kp = &k->procs[i];
+    kp->pid = p->pid;
+    kp->status = p->status;
+    kp->nice = p->nice;
+    kp->weight = sched_nice_to_weight(p->nice);
+    kp->cpu = p->cpu;
+    kp->ticks = timer_run_ticks(p);
+    kp->mem = p->total_mem_count;
+  }
+
+  __sync_synchronize();
+  k->seq++;
+}
@@ -0,0 +1,61 @@
+/*
+ * the kernel info page: a read-only page mapped at USER_KINFO_VA in every process, that
+ * the kernel keeps up to date with its statistics. user programs read it without any
+ * syscall (see kinfo_read in user/user_lib.c).
+ */
+#ifndef _KINFO_H_
+#define _KINFO_H_
+
+#include "util/types.h"
+
+// values of kinfo_proc.status: those of enum proc_status (see process.h)
+#define KINFO_FREE    0  // unused slot
+#define KINFO_READY   1
+#define KINFO_RUNNING 2
+#define KINFO_BLOCKED 3
+#define KINFO_ZOMBIE  4
+
+// statistics of one process
+typedef struct kinfo_proc {
+  uint64 pid;
+  int32 status;  // KINFO_*
+  int32 nice;
+  int32 weight;  // scheduling weight, following from nice
+  int32 cpu;     // hart the process runs on (or is queued on)
+  uint64 ticks;  // ticks charged to the process
+  uint64 mem;    // memory held, in pages
+} kinfo_proc;
+
+#define KINFO_HEADER_SIZE 128
+// number of processes the page has room for, procs[] beyond it are not exported
+#define KINFO_MAX_PROCS ((4096 - KINFO_HEADER_SIZE) / sizeof(kinfo_proc))
+
+typedef struct kinfo {
+  // seqlock: odd while the kernel updates the page. a reader copies the page while seq
+  // is even, and again if seq has changed meanwhile
+  uint64 seq;
+  // TIMER_INTERVALs since boot, and the time (mtime) of the update
+  uint64 ticks;
+  uint64 mtime;
+  uint64 timebase_freq;
+  // memory size, in bytes
+  uint64 mem_size;
+  // scheduler: name of the policy, context switches, and processes by status
+  char sched_policy[8];
+  uint64 nr_switches;
+  int32 nr_ready;
+  int32 nr_running;
+  int32 nr_blocked;
+  int32 nr_zombie;
+  // valid entries in procs[]
+  int32 nproc;
+  char pad[KINFO_HEADER_SIZE - 76];
+  kinfo_proc procs[KINFO_MAX_PROCS];
+} kinfo;
+
+struct process;
+void kinfo_init(void);
+void kinfo_map(struct process* p);
+void kinfo_update(struct process* p, int switched);
+
+#endif
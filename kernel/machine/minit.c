@@ -23,8 +23,11 @@ extern void mtrapvec();
 extern uint64 htif;
 // g_mem_size is defined in kernel/machine/spike_memory.c, size of the emulated memory
 extern uint64 g_mem_size;
-// g_itrframe is used for saving registers when interrupt hapens in M mode
-struct riscv_regs g_itrframe;
+// g_itrframe is used for saving registers when interrupt hapens in M mode, one per hart
+struct riscv_regs g_itrframe[NCPU];
+
+// set by hart 0 once the HTIF and the memory size are known, the other harts wait for it
+static volatile int g_machine_ready = 0;
 
 //
 // get the information of HTIF (calling interface) and the emulated memory by
@@ -58,7 +61,8 @@ static void delegate_traps() {
   uintptr_t interrupts = MIP_SSIP | MIP_STIP | MIP_SEIP;
   uintptr_t exceptions = (1U << CAUSE_MISALIGNED_FETCH) | (1U << CAUSE_FETCH_PAGE_FAULT) |
                          (1U << CAUSE_BREAKPOINT) | (1U << CAUSE_LOAD_PAGE_FAULT) |
-                         (1U << CAUSE_STORE_PAGE_FAULT) | (1U << CAUSE_USER_ECALL);
+                         (1U << CAUSE_STORE_PAGE_FAULT) | (1U << CAUSE_USER_ECALL) |
+                         (1U << CAUSE_ILLEGAL_INSTRUCTION);
 
   write_csr(mideleg, interrupts);
   write_csr(medeleg, exceptions);
@@ -67,29 +71,39 @@ static void delegate_traps() {
 }
 
 //
-// enabling timer interrupt (irq) in Machine mode
+// enabling timer and software (IPI) interrupts (irq) in Machine mode
 //
 void timerinit(uintptr_t hartid) {
-  // fire timer irq after TIMER_INTERVAL from now.
-  *(uint64*)CLINT_MTIMECMP(hartid) = *(uint64*)CLINT_MTIME + TIMER_INTERVAL;
+  // no deadline yet, the S-mode kernel sets one when it needs it (see kernel/timer.c)
+  *(uint64*)CLINT_MTIMECMP(hartid) = -1;
+  *(uint32*)CLINT_MSIP(hartid) = 0;
 
-  // enable machine-mode timer irq in MIE (Machine Interrupt Enable) csr.
-  write_csr(mie, read_csr(mie) | MIE_MTIE);
+  // enable machine-mode timer and software irqs in MIE (Machine Interrupt Enable) csr.
+  write_csr(mie, read_csr(mie) | MIE_MTIE | MIE_MSIE);
 }
 
 //
 // m_start: machine mode C entry point.
 //
 void m_start(uintptr_t hartid, uintptr_t dtb) {
-  // init the spike file interface (stdin,stdout,stderr)
-  spike_file_init();
-  sprint("In m_start, hartid:%d\n", hartid);
-
-  // init HTIF (Host-Target InterFace) and memory by using the Device Table Blob (DTB)
-  init_dtb(dtb);
+  if (hartid == 0) {
+    // init the spike file interface (stdin,stdout,stderr)
+    spike_file_init();
+    sprint("In m_start, hartid:%d\n", hartid);
+
+    // init HTIF (Host-Target InterFace) and memory by using the Device Table Blob (DTB)
+    init_dtb(dtb);
+
+    __sync_synchronize();
+    g_machine_ready = 1;
+  } else {
+    while (!g_machine_ready)
+      ;
+    __sync_synchronize();
+  }
 
   // save the address of frame for interrupt in M mode to csr "mscratch".
-  write_csr(mscratch, &g_itrframe);
+  write_csr(mscratch, &g_itrframe[hartid]);
 
   // set previous privilege mode to S (Supervisor), and will enter S mode after 'mret'
   write_csr(mstatus, ((read_csr(mstatus) & ~MSTATUS_MPP_MASK) | MSTATUS_MPP_S));
@@ -105,10 +119,16 @@ void m_start(uintptr_t hartid, uintptr_t dtb) {
 
   // delegate all interrupts and exceptions to supervisor mode.
   delegate_traps();
+
+  // let S and U modes read the cycle, time and instret counters
+  write_csr(mcounteren, COUNTEREN_CY | COUNTEREN_TM | COUNTEREN_IR);
   write_csr(sie, read_csr(sie) | SIE_SEIE | SIE_STIE | SIE_SSIE);
 
   timerinit(hartid);
 
+  // the S-mode kernel keeps the hart id in tp (see cpuid() in kernel/smp.h)
+  write_tp(hartid);
+
   // switch to supervisor mode and jump to s_start(), i.e., set pc to mepc
   asm volatile("mret");
 }
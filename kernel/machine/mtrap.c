@@ -1,5 +1,6 @@
 #include "kernel/riscv.h"
 #include "kernel/process.h"
+#include "kernel/sbi.h"
 #include "spike_interface/spike_utils.h"
 
 static void handle_instruction_access_fault() { panic("Instruction access fault!"); }
@@ -15,14 +16,47 @@ static void handle_misaligned_load() { panic("Misaligned Load!"); }
 static void handle_misaligned_store() { panic("Misaligned AMO!"); }
 
 static void handle_timer() {
-  int cpuid = 0;
-  // setup the timer fired at next time (TIMER_INTERVAL from now)
-  *(uint64*)CLINT_MTIMECMP(cpuid) = *(uint64*)CLINT_MTIMECMP(cpuid) + TIMER_INTERVAL;
+  int hartid = read_csr(mhartid);
+  // the timer is one-shot: S-mode sets the next deadline, if any, with SBI_SET_TIMER
+  *(uint64*)CLINT_MTIMECMP(hartid) = -1;
 
-  // setup a soft interrupt in sip (S-mode Interrupt Pending) to be handled in S-mode
+  // pass the timer interrupt on to S-mode, it stays pending until S-mode sets the timer
+  set_csr(mip, MIP_STIP);
+}
+
+//
+// another hart has sent this one an IPI (SBI_SEND_IPI), pass it on to S-mode.
+//
+static void handle_soft() {
+  int hartid = read_csr(mhartid);
+  *(uint32*)CLINT_MSIP(hartid) = 0;
   write_csr(sip, SIP_SSIP);
 }
 
+//
+// serve an ecall of the S-mode kernel, see kernel/sbi.h.
+//
+static void handle_supervisor_ecall() {
+  // mtrapvec has saved the registers of S-mode in the frame that mscratch points to
+  riscv_regs* regs = (riscv_regs*)read_csr(mscratch);
+  int hartid = read_csr(mhartid);
+
+  switch (regs->a7) {
+    case SBI_SET_TIMER:
+      *(uint64*)CLINT_MTIMECMP(hartid) = regs->a0;
+      clear_csr(mip, MIP_STIP);
+      break;
+    case SBI_SEND_IPI:
+      *(uint32*)CLINT_MSIP(regs->a0) = 1;
+      break;
+    default:
+      panic("unknown SBI call %ld from S-mode.\n", regs->a7);
+  }
+
+  // return to the instruction after the ecall
+  write_csr(mepc, read_csr(mepc) + 4);
+}
+
 //
 // handle_mtrap calls cooresponding functions to handle an exception of a given type.
 //
@@ -32,6 +66,12 @@ void handle_mtrap() {
     case CAUSE_MTIMER:
       handle_timer();
       break;
+    case CAUSE_MSOFT:
+      handle_soft();
+      break;
+    case CAUSE_SUPERVISOR_ECALL:
+      handle_supervisor_ecall();
+      break;
     case CAUSE_FETCH_ACCESS:
       handle_instruction_access_fault();
       break;
@@ -14,7 +14,19 @@
 // virtual address of stack top of user process
 #define USER_STACK_TOP 0x7ffff000
 
+// the read-only kernel info page (see kinfo.h) lies right above the user stack
+#define USER_KINFO_VA USER_STACK_TOP
+
 // simple heap bottom, virtual address starts from 4MB
 #define USER_FREE_ADDRESS_START 0x00000000 + PGSIZE * 1024
 
+// per-process heap (sbrk) grows up from USER_HEAP_START, anonymous mmap ranges are placed
+// in [USER_MMAP_START, USER_MMAP_END)
+#define USER_HEAP_START USER_FREE_ADDRESS_START
+#define USER_MMAP_START 0x40000000
+#define USER_MMAP_END 0x70000000
+
+// the syscall rings of a process (see syscall_ring.h) follow the mmap ranges
+#define USER_RING_VA USER_MMAP_END
+
 #endif
@@ -16,51 +16,256 @@ extern uint64 g_mem_size;
 static uint64 free_mem_start_addr;  //beginning address of free memory
 static uint64 free_mem_end_addr;    //end address of free memory (not included)
 
+// a free block of 2^order pages keeps its list node in its first page
 typedef struct node {
   struct node *next;
+  struct node *prev;
 } list_node;
 
-// g_free_mem_list is the head of the list of free physical memory pages
-static list_node g_free_mem_list;
+// g_free_area[k] is the (circular) list of free blocks of 2^k pages
+static list_node g_free_area[PMM_MAX_ORDER + 1];
+
+// frame descriptors of all pages in [DRAM_BASE, free_mem_end_addr). the array itself
+// is placed at the beginning of free memory by pmm_init().
+static struct page *g_mem_map;
+static uint64 g_mem_map_npages;
+
+// free memory is brought into the buddy system one section (the size of the largest
+// buddy block) at a time. frames below g_init_end_pfn have initialized descriptors and
+// are known to the buddy system; [g_init_end_pfn, g_mem_map_npages) is still untouched.
+#define SECTION_PAGES (1UL << PMM_MAX_ORDER)
+static uint64 g_init_end_pfn;
+
+// frame numbers are counted from DRAM_BASE, so that a block of 2^k pages is also
+// aligned to 2^k pages in physical memory.
+#define PA2PFN(pa) (((uint64)(pa) - DRAM_BASE) >> PGSHIFT)
+#define PFN2PA(pfn) ((void *)(((uint64)(pfn) << PGSHIFT) + DRAM_BASE))
+
+static void list_add(list_node *head, list_node *n) {
+  n->next = head->next;
+  n->prev = head;
+  head->next->prev = n;
+  head->next = n;
+}
+
+static void list_del(list_node *n) {
+  n->prev->next = n->next;
+  n->next->prev = n->prev;
+}
 
 //
-// actually creates the freepage list. each page occupies 4KB (PGSIZE)
+// returns 1 if the block [pfn, pfn+2^order) lies completely in initialized free memory
 //
-static void create_freepage_list(uint64 start, uint64 end) {
-  g_free_mem_list.next = 0;
-  for (uint64 p = ROUNDUP(start, PGSIZE); p + PGSIZE < end; p += PGSIZE)
-    free_page( (void *)p );
+static int block_in_range(uint64 pfn, int order) {
+  return (uint64)PFN2PA(pfn) >= free_mem_start_addr && pfn + (1UL << order) <= g_init_end_pfn;
 }
 
 //
-// place a physical page at *pa to the free list of g_free_mem_list (to reclaim the page)
+// put a free block of 2^order pages starting at frame pfn onto its free list
 //
-void free_page(void *pa) {
-  if (((uint64)pa % PGSIZE) != 0 || (uint64)pa < free_mem_start_addr || (uint64)pa >= free_mem_end_addr)
-    panic("free_page 0x%lx \n", pa);
+static void insert_free_block(uint64 pfn, int order) {
+  g_mem_map[pfn].flags |= PG_buddy;
+  g_mem_map[pfn].order = order;
+  list_add(&g_free_area[order], (list_node *)PFN2PA(pfn));
+}
+
+//
+// take the free block of 2^order pages starting at frame pfn off its free list
+//
+static void remove_free_block(uint64 pfn, int order) {
+  g_mem_map[pfn].flags &= ~PG_buddy;
+  list_del((list_node *)PFN2PA(pfn));
+}
+
+static int grow_free_area(void);
+
+//
+// frame descriptor of the page at *pa, NULL if pa is not managed by pmm
+//
+struct page *pa_to_page(void *pa) {
+  if ((uint64)pa < DRAM_BASE || PA2PFN(pa) >= g_init_end_pfn) return NULL;
+  return &g_mem_map[PA2PFN(pa)];
+}
+
+//
+// physical address of the page described by *page
+//
+void *page_to_pa(struct page *page) {
+  return PFN2PA(page - g_mem_map);
+}
+
+//
+// frame descriptor of an allocatable page, NULL for kernel or unmanaged memory
+//
+static struct page *managed_page(void *pa) {
+  struct page *page = pa_to_page(pa);
+  if (page == NULL || (page->flags & PG_reserved)) return NULL;
+  return page;
+}
+
+//
+// take an extra reference to the page at *pa
+//
+void get_page(void *pa) {
+  struct page *page = managed_page(pa);
+  if (page == NULL) return;
+  if (page->refcount <= 0) panic("get_page: page 0x%lx is free \n", pa);
+  page->refcount++;
+}
+
+//
+// drop a reference to the page at *pa, the page is freed when the last one drops
+//
+void put_page(void *pa) {
+  struct page *page = managed_page(pa);
+  if (page == NULL) return;
+  if (page->refcount <= 0) panic("put_page: page 0x%lx is free \n", pa);
+  if (--page->refcount == 0) free_page((void *)ROUNDDOWN((uint64)pa, PGSIZE));
+}
+
+//
+// record that a user page table entry maps / stops mapping the page at *pa
+//
+void page_add_mapping(void *pa) {
+  struct page *page = managed_page(pa);
+  if (page) page->mapcount++;
+}
+
+void page_remove_mapping(void *pa) {
+  struct page *page = managed_page(pa);
+  if (page) page->mapcount--;
+}
 
-  // insert a physical page to g_free_mem_list
-  list_node *n = (list_node *)pa;
-  n->next = g_free_mem_list.next;
-  g_free_mem_list.next = n;
+//
+// smallest order whose block covers "size" bytes
+//
+int get_order(uint64 size) {
+  int order = 0;
+  while (((uint64)PGSIZE << order) < size) order++;
+  return order;
+}
+
+//
+// give a block of 2^order pages at *pa back to the buddy system. the block is merged
+// with its buddy as long as the buddy is free as a whole, so that large blocks reform.
+//
+void free_pages(void *pa, int order) {
+  uint64 pfn = PA2PFN(pa);
+  if (order < 0 || order > PMM_MAX_ORDER || ((uint64)pa % PGSIZE) != 0 ||
+      (pfn & ((1UL << order) - 1)) != 0 || !block_in_range(pfn, order))
+    panic("free_pages 0x%lx (order %d) \n", pa, order);
+  if (g_mem_map[pfn].flags & PG_buddy)
+    panic("free_pages: double free of 0x%lx \n", pa);
+
+  for (uint64 i = 0; i < (1UL << order); i++) {
+    g_mem_map[pfn + i].refcount = 0;
+    g_mem_map[pfn + i].mapcount = 0;
+    g_mem_map[pfn + i].flags = 0;
+  }
   if ( current != NULL )
-    -- current->total_mem_count;
+    current->total_mem_count -= 1 << order;
+
+  // merge with the buddy block while it is free and of the same order
+  for (; order < PMM_MAX_ORDER; order++) {
+    uint64 buddy = pfn ^ (1UL << order);
+    if (!block_in_range(buddy, order) || !(g_mem_map[buddy].flags & PG_buddy) ||
+        g_mem_map[buddy].order != order)
+      break;
+    remove_free_block(buddy, order);
+    pfn &= ~(1UL << order);
+  }
+  insert_free_block(pfn, order);
 }
 
 //
-// takes the first free page from g_free_mem_list, and returns (allocates) it.
-// Allocates only ONE page!
+// takes the smallest free block that can hold 2^order pages, splits it down to the
+// requested order, and returns (allocates) it. returns NULL if no such block exists.
 //
-void *alloc_page(void) {
-  list_node *n = g_free_mem_list.next;
-  if (n) g_free_mem_list.next = n->next;
+void *alloc_pages(int order) {
+  int k;
+  if (order < 0 || order > PMM_MAX_ORDER) return NULL;
+
+  // split an existing block if possible. only when none is large enough, bring the
+  // next untouched section of free memory into the buddy system.
+  for (;;) {
+    for (k = order; k <= PMM_MAX_ORDER; k++)
+      if (g_free_area[k].next != &g_free_area[k]) break;
+    if (k <= PMM_MAX_ORDER) break;
+    if (!grow_free_area()) return NULL;
+  }
+
+  uint64 pfn = PA2PFN(g_free_area[k].next);
+  remove_free_block(pfn, k);
+
+  // return the upper halves we do not need to the lower-order lists
+  while (k > order) {
+    k--;
+    insert_free_block(pfn + (1UL << k), k);
+  }
+
+  // every page of the block starts with one reference, so that a block may also be
+  // released page by page through put_page()
+  for (uint64 i = 0; i < (1UL << order); i++) g_mem_map[pfn + i].refcount = 1;
+
   if ( current != NULL )
-    ++ current->total_mem_count;
-  return (void *)n;
+    current->total_mem_count += 1 << order;
+  return PFN2PA(pfn);
+}
+
+//
+// place a physical page at *pa back to the buddy system (to reclaim the page)
+//
+void free_page(void *pa) {
+  free_pages(pa, 0);
+}
+
+//
+// allocates only ONE page!
+//
+void *alloc_page(void) {
+  return alloc_pages(0);
+}
+
+//
+// hand the free frames [start, end) to the buddy system, as blocks that are as large
+// as their alignment allows. only the head of each block is touched.
+//
+static void add_free_range(uint64 start, uint64 end) {
+  uint64 pfn = start;
+  while (pfn < end) {
+    int order = PMM_MAX_ORDER;
+    while ((pfn & ((1UL << order) - 1)) != 0 || pfn + (1UL << order) > end) order--;
+    insert_free_block(pfn, order);
+    pfn += 1UL << order;
+  }
+}
+
+//
+// initialize the frame descriptors of the next untouched section, and release its
+// frames to the buddy system. returns 0 if all of memory is initialized already.
+//
+static int grow_free_area(void) {
+  if (g_init_end_pfn >= g_mem_map_npages) return 0;
+
+  uint64 start = g_init_end_pfn;
+  uint64 end = MIN(ROUNDDOWN(start, SECTION_PAGES) + SECTION_PAGES, g_mem_map_npages);
+  memset(&g_mem_map[start], 0, (end - start) * sizeof(struct page));
+  g_init_end_pfn = end;
+  add_free_range(start, end);
+  return 1;
+}
+
+//
+// initialize one more section of free memory in the background, so that the cost of
+// the first allocations from it does not fall onto a later, time-critical, caller.
+// returns 0 once all of free memory is initialized.
+//
+int pmm_deferred_init(void) {
+  return grow_free_area();
 }
 
 //
-// pmm_init() establishes the list of free physical pages according to available
+// pmm_init() establishes the buddy system of free physical pages according to available
 // physical memory space.
 //
 void pmm_init() {
@@ -82,10 +287,32 @@ void pmm_init() {
     panic( "Error when recomputing physical memory size (g_mem_size).\n" );
 
   free_mem_end_addr = g_mem_size + DRAM_BASE;
+
+  // place the frame descriptors right after the kernel. the kernel image and the
+  // descriptors themselves are reserved.
+  g_mem_map = (struct page *)free_mem_start_addr;
+  g_mem_map_npages = PA2PFN(free_mem_end_addr);
+  free_mem_start_addr = ROUNDUP(free_mem_start_addr + g_mem_map_npages * sizeof(struct page),
+    PGSIZE);
+  g_init_end_pfn = PA2PFN(free_mem_start_addr);
+  memset(g_mem_map, 0, g_init_end_pfn * sizeof(struct page));
+  for (uint64 pfn = 0; pfn < g_init_end_pfn; pfn++)
+    g_mem_map[pfn].flags = PG_reserved;
+  sprint("frame descriptors: %ld pages at 0x%lx \n", g_mem_map_npages, g_mem_map);
+
   sprint("free physical memory address: [0x%lx, 0x%lx] \n", free_mem_start_addr,
     free_mem_end_addr - 1);
 
   sprint("kernel memory manager is initializing ...\n");
-  // create the list of free pages
-  create_freepage_list(free_mem_start_addr, free_mem_end_addr);
+  for (int k = 0; k <= PMM_MAX_ORDER; k++)
+    g_free_area[k].next = g_free_area[k].prev = &g_free_area[k];
+
+  // bring only the first section of free memory into the buddy system. the others are
+  // recorded as the untouched range above g_init_end_pfn, and are initialized when the
+  // buddy system runs dry, or in the background by pmm_deferred_init().
+  grow_free_area();
+#if !PMM_LAZY_INIT
+  while (grow_free_area())
+    ;
+#endif
 }
@@ -1,11 +1,50 @@
 #ifndef _PMM_H_
 #define _PMM_H_
 
+#include "util/types.h"
+
+// largest block handed out by the buddy allocator is 2^PMM_MAX_ORDER pages (4MB)
+#define PMM_MAX_ORDER 10
+
+// page frame descriptor. one for every physical page, kept in an array indexed by
+// the frame number counted from DRAM_BASE.
+struct page {
+  int32 refcount;   // references to the frame, it is freed when the last one drops
+  int32 mapcount;   // number of user page table entries mapping the frame
+  uint16 flags;     // PG_* flags below
+  uint8 order;      // order of the free block headed by the frame (with PG_buddy)
+};
+
+// flags of struct page
+#define PG_reserved 0x1   // kernel image or frame descriptors, never allocated
+#define PG_buddy    0x2   // heads a free block in the buddy system
+#define PG_slab     0x4   // heads a slab of kmem_cache objects
+
 // Initialize phisical memeory manager
 void pmm_init();
+// Initialize one more section of free memory (called in the background)
+int pmm_deferred_init(void);
+// Allocate 2^order physically contiguous pages
+void* alloc_pages(int order);
+// Free a block of 2^order pages obtained from alloc_pages
+void free_pages(void* pa, int order);
 // Allocate a free phisical page
 void* alloc_page();
 // Free an allocated page
 void free_page(void* pa);
+// smallest order whose block covers "size" bytes
+int get_order(uint64 size);
+
+// frame descriptor of the page at *pa, NULL if pa is not managed by pmm
+struct page* pa_to_page(void* pa);
+// physical address of the page described by *page
+void* page_to_pa(struct page* page);
+// take an extra reference to the page at *pa
+void get_page(void* pa);
+// drop a reference to the page at *pa, the page is freed when the last one drops
+void put_page(void* pa);
+// record that a user page table entry maps / stops mapping the page at *pa
+void page_add_mapping(void* pa);
+void page_remove_mapping(void* pa);
 
-#endif
\ No newline at end of file
+#endif
@@ -16,7 +16,15 @@
 #include "pmm.h"
 #include "memlayout.h"
 #include "sched.h"
+#include "timer.h"
+#include "fp.h"
+#include "kinfo.h"
 #include "file.h"
+#include "slab.h"
+#include "workqueue.h"
+#include "syscall_ring.h"
+#include "util/functions.h"
+#include "spike_interface/atomic.h"
 #include "spike_interface/spike_utils.h"
 
 //Two functions defined in kernel/usertrap.S
@@ -31,19 +39,16 @@ extern char trap_sec_start[];
 
 //
 // global variable that store the recorded "ticks" in strap.c
-extern uint64 g_ticks;
 // g_mem_size is defined in spike_interface/spike_memory.c, it indicates the size of our
 // (emulated) spike machine.
 extern uint64 g_mem_size;
 
-// current points to the currently running user-mode application.
-process* current = NULL;
+// process pool, allocated by init_proc_pool
+process* procs = NULL;
+int g_nproc = 0;
 
-// process pool
-process procs[NPROC];
-
-// start virtual address of our simple heap.
-uint64 g_ufree_page = USER_FREE_ADDRESS_START;
+// address spaces, shared by the threads of a process
+static struct kmem_cache* mm_cachep;
 
 //
 // switch to a user-mode process
@@ -55,9 +60,10 @@ void switch_to(process* proc) {
   write_csr(stvec, (uint64)smode_trap_vector);
   // set up trapframe values that smode_trap_vector will need when
   // the process next re-enters the kernel.
-  proc->trapframe->kernel_sp = proc->kstack;      // process's kernel stack
+  proc->trapframe->kernel_sp = g_cpus[cpuid()].kstack;  // this hart's kernel stack
   proc->trapframe->kernel_satp = read_csr(satp);  // kernel page table
   proc->trapframe->kernel_trap = (uint64)smode_trap_handler;
+  proc->trapframe->kernel_hartid = cpuid();
 
   // set up the registers that strap_vector.S's sret will use
   // to get to user space.
@@ -73,96 +79,258 @@ void switch_to(process* proc) {
   write_csr(sepc, proc->trapframe->epc);
 
   //make user page table
-  uint64 user_satp = MAKE_SATP(proc->pagetable);
-
-  // switch to user mode with sret.
+  uint64 user_satp = MAKE_SATP_ASID(proc->mm->pagetable, asid_get(&proc->mm->asid));
+  // page table updates made while the process ran on another hart were only flushed
+  // from the TLB of that hart
+  if (proc->last_cpu >= 0 && proc->last_cpu != cpuid()) asid_flush(proc->mm->asid);
+  proc->last_cpu = cpuid();
+
+  // set the timer for the next deadline of this hart, if any
+  timer_program();
+  timer_fast_setup(proc);
+
+  // the FPU is on only if the FP registers of this hart hold the state of proc
+  fp_enter(proc);
+
+#if KERNEL_IN_USER_PT
+  // the kernel runs on the user page table already, when it serves a trap of proc. other
+  // harts may free the page table this hart was on once the lock is released.
+  if (read_csr(satp) != user_satp) write_csr(satp, user_satp);
+#endif
+
+  // leave the kernel to other harts, and switch to user mode with sret.
+  atomic_set(&g_cpus[cpuid()].in_user, 1);
+  kernel_unlock();
   return_to_user(proc->trapframe, user_satp);
 }
 
 //
 // initialize process pool (the procs[] array)
 //
-void init_proc_pool() {
-  memset( procs, 0, sizeof(struct process)*NPROC );
-
-  for (int i = 0; i < NPROC; ++i) {
+void init_proc_pool(int nproc) {
+  if ( nproc <= 0 ) panic( "invalid number of processes %d.\n", nproc );
+  procs = (process*)alloc_pages( get_order(sizeof(struct process)*nproc) );
+  if ( procs == NULL ) panic( "cannot allocate a pool of %d processes.\n", nproc );
+  g_nproc = nproc;
+  memset( procs, 0, sizeof(struct process)*nproc );
+
+  for (int i = 0; i < nproc; ++i) {
     procs[i].status = FREE;
     procs[i].pid = i;
     procs[i].tick_count = 0;
     procs[i].total_tick_count = 0;
+    procs[i].run_time = 0;
     procs[i].total_mem_count = 0;
   }
+
+  mm_cachep = kmem_cache_create("mm_struct", sizeof(mm_struct), NULL);
 }
 
 //
-// allocate an empty process, init its vm space. returns its pid
+// map the trapframe of p in its address space (direct mapping as in kernel space).
 //
-process* alloc_process() {
-  // locate the first usable process structure
-  int i;
-
-  for( i=0; i<NPROC; i++ )
-    if( procs[i].status == FREE ) break;
-
-  if( i>=NPROC ){
-    panic( "cannot find any free process structure.\n" );
-    return 0;
-  }
+static void map_trapframe(process* p) {
+#if !KERNEL_IN_USER_PT
+  user_vm_map((pagetable_t)p->mm->pagetable, (uint64)p->trapframe, PGSIZE,
+    (uint64)p->trapframe, prot_to_type(PROT_WRITE | PROT_READ, 0));
+#endif
+  // with KERNEL_IN_USER_PT, the trapframe is mapped with the rest of the kernel
+}
 
-  procs[i].total_mem_count = 0;
+static void free_trapframe(process* p) {
+#if KERNEL_IN_USER_PT
+  // mapped as part of the kernel, which must stay mapped
+  put_page(p->trapframe);
+#else
+  user_vm_unmap(p->mm->pagetable, (uint64)p->trapframe, PGSIZE, 1);
+#endif
+  p->trapframe = NULL;
+}
 
-  // init proc[i]'s vm space
-  procs[i].trapframe = (trapframe *)alloc_page();  //trapframe, used to save context
-  memset(procs[i].trapframe, 0, sizeof(trapframe));
+//
+// give p a new address space, with its user stack, its trapframe, the trap vector and
+// the kernel info page mapped.
+//
+static void mm_create(process* p) {
+  mm_struct* mm = (mm_struct*)kmem_cache_alloc(mm_cachep);
+  if ( mm == NULL ) panic( "cannot allocate an address space.\n" );
+  memset(mm, 0, sizeof(mm_struct));
+  mm->users = 1;
+  p->mm = mm;
 
   // page directory
-  procs[i].pagetable = (pagetable_t)alloc_page();
-  memset((void *)procs[i].pagetable, 0, PGSIZE);
+  mm->pagetable = (pagetable_t)alloc_page();
+  memset((void *)mm->pagetable, 0, PGSIZE);
 
-  procs[i].kstack = (uint64)alloc_page() + PGSIZE;   //user kernel stack top
   uint64 user_stack = (uint64)alloc_page();       //phisical address of user stack bottom
-  procs[i].trapframe->regs.sp = USER_STACK_TOP;  //virtual address of user stack top
+  p->trapframe->regs.sp = USER_STACK_TOP;  //virtual address of user stack top
 
   // allocates a page to record memory regions (segments)
-  procs[i].mapped_info = (mapped_region*)alloc_page();
-  memset( procs[i].mapped_info, 0, PGSIZE );
+  mm->mapped_info = (mapped_region*)alloc_page();
+  memset( mm->mapped_info, 0, PGSIZE );
 
   // map user stack in userspace
-  user_vm_map((pagetable_t)procs[i].pagetable, USER_STACK_TOP - PGSIZE, PGSIZE,
+  user_vm_map((pagetable_t)mm->pagetable, USER_STACK_TOP - PGSIZE, PGSIZE,
     user_stack, prot_to_type(PROT_WRITE | PROT_READ, 1));
-  procs[i].mapped_info[0].va = USER_STACK_TOP - PGSIZE;
-  procs[i].mapped_info[0].npages = 1;
-  procs[i].mapped_info[0].seg_type = STACK_SEGMENT;
-
-  // map trapframe in user space (direct mapping as in kernel space).
-  user_vm_map((pagetable_t)procs[i].pagetable, (uint64)procs[i].trapframe, PGSIZE,
-    (uint64)procs[i].trapframe, prot_to_type(PROT_WRITE | PROT_READ, 0));
-  procs[i].mapped_info[1].va = (uint64)procs[i].trapframe;
-  procs[i].mapped_info[1].npages = 1;
-  procs[i].mapped_info[1].seg_type = CONTEXT_SEGMENT;
+  mm->mapped_info[0].va = USER_STACK_TOP - PGSIZE;
+  mm->mapped_info[0].npages = 1;
+  mm->mapped_info[0].seg_type = STACK_SEGMENT;
+
+#if KERNEL_IN_USER_PT
+  // map the kernel in user space, which covers the trapframe and the trap vector.
+  user_vm_map_kernel((pagetable_t)mm->pagetable);
+#endif
+  map_trapframe(p);
+  mm->mapped_info[1].va = (uint64)p->trapframe;
+  mm->mapped_info[1].npages = 1;
+  mm->mapped_info[1].seg_type = CONTEXT_SEGMENT;
 
   // map S-mode trap vector section in user space (direct mapping as in kernel space)
   // we assume that the size of usertrap.S is smaller than a page.
-  user_vm_map((pagetable_t)procs[i].pagetable, (uint64)trap_sec_start, PGSIZE,
+#if !KERNEL_IN_USER_PT
+  user_vm_map((pagetable_t)mm->pagetable, (uint64)trap_sec_start, PGSIZE,
     (uint64)trap_sec_start, prot_to_type(PROT_READ | PROT_EXEC, 0));
-  procs[i].mapped_info[2].va = (uint64)trap_sec_start;
-  procs[i].mapped_info[2].npages = 1;
-  procs[i].mapped_info[2].seg_type = SYSTEM_SEGMENT;
+#endif
+  mm->mapped_info[2].va = (uint64)trap_sec_start;
+  mm->mapped_info[2].npages = 1;
+  mm->mapped_info[2].seg_type = SYSTEM_SEGMENT;
+
+  // map the kernel info page, read-only and shared by all processes
+  kinfo_map(p);
+  mm->mapped_info[3].va = USER_KINFO_VA;
+  mm->mapped_info[3].npages = 1;
+  mm->mapped_info[3].seg_type = SYSTEM_SEGMENT;
+
+  sprint("in alloc_proc. user frame 0x%lx, user stack 0x%lx \n",
+    p->trapframe, p->trapframe->regs.sp);
+
+  mm->total_mapped_region = 4;
+  mm->heap_top = USER_HEAP_START;
+}
+
+//
+// free an address space that has no users left: the regions mapped in it (but the
+// trapframes, which belong to its processes), its page table and the mm_struct.
+//
+static void mm_free(void* arg) {
+  mm_struct* mm = (mm_struct*)arg;
+  for( int j=0; j<mm->total_mapped_region; ++ j ){
+    switch( mm->mapped_info[j].seg_type ){
+      case STACK_SEGMENT:   // free user stack
+      case DATA_SEGMENT:    // free data segment
+      case HEAP_SEGMENT:    // free heap
+      case MMAP_SEGMENT:    // free anonymous ranges
+      case RING_SEGMENT:    // free the syscall rings
+      case CODE_SEGMENT:    // code pages may be shared, they are freed with the last user
+        user_vm_unmap(mm->pagetable, 
+                      mm->mapped_info[j].va, 
+                      mm->mapped_info[j].npages*PGSIZE, 
+                      1);
+        break;
+    }
+  }
+  free_page(mm->mapped_info);
+  free_page(mm->pagetable);
+  elf_release_file(mm);
+  asid_flush(mm->asid);
+  kmem_cache_free(mm_cachep, mm);
+}
+
+//
+// drop a user of mm. the last one frees it, as deferred work: no hart runs on its page
+// table any more, and the processes that used it need not wait for the pages to be freed.
+//
+static void mm_put(mm_struct* mm) {
+  if( -- mm->users > 0 ) return;
+  queue_work(&mm->free_work, mm_free, mm);
+}
+
+//
+// locate the first usable process structure, and set up what does not depend on its
+// address space. returns it with no address space (mm) yet.
+//
+static process* alloc_task() {
+  int i;
+
+  for( i=0; i<g_nproc; i++ )
+    if( procs[i].status == FREE ) break;
+
+  if( i>=g_nproc ){
+    panic( "cannot find any free process structure.\n" );
+    return 0;
+  }
 
-  sprint("in alloc_proc. user frame 0x%lx, user stack 0x%lx, user kstack 0x%lx \n",
-    procs[i].trapframe, procs[i].trapframe->regs.sp, procs[i].kstack);
+  procs[i].total_mem_count = 0;
+
+  // init proc[i]'s trapframe, used to save context
+  procs[i].trapframe = (trapframe *)alloc_page();
+  memset(procs[i].trapframe, 0, sizeof(trapframe));
 
-  procs[i].total_mapped_region = 3;
+  procs[i].mm = NULL;
+  procs[i].is_thread = 0;
+  procs[i].last_cpu = -1;
+  memset(&procs[i].fp, 0, sizeof(fp_state));
+  procs[i].fp_cpu = -1;
 
   procs[i].total_tick_count = 0;
-  procs[i].tick_count = 0;
+  procs[i].run_time = 0;
+  procs[i].run_start = timer_now();
+  procs[i].nice = 0;
+  return &procs[i];
+}
+
+//
+// allocate an empty process, init its vm space. returns its pid
+//
+process* alloc_process() {
+  process* p = alloc_task();
+
+  // init p's vm space
+  mm_create(p);
+  sched_new_process( p );
 
   // initialize files_struct
-  procs[i].pfiles = files_create();
+  p->pfiles = files_create();
   sprint("in alloc_proc. build files_struct successfully.\n");
   
   // return after initialization.
-  return &procs[i];
+  return p;
+}
+
+//
+// give the process structure p back to the pool, along with its trapframe and its
+// reference to the address space.
+//
+static void release_process(process* p){
+  // the address space goes with its last user
+  free_trapframe(p);
+  mm_put(p->mm);
+  p->mm = NULL;
+
+  // the children (and threads) of p have no parent to reap them any more: those that
+  // have exited are released now, the others when they exit (free_process)
+  for ( int j = 0; j < g_nproc; ++ j ){
+    if ( procs[j].parent != p ) continue;
+    procs[j].parent = NULL;
+    if ( procs[j].status == ZOMBIE ) release_process(&procs[j]);
+  }
+
+  p->status = FREE;
+  p->parent = NULL;
+  p->queue_next = NULL;
+  p->queue_prev = NULL;
+  p->tick_count = 0;
+  p->total_mem_count = 0;
+  p->total_tick_count = 0;
+  p->run_time = 0;
+  kinfo_update(p, 0);
+}
+
+//
+// release an orphan that has exited (deferred work queued by free_process)
+//
+static void reap_orphan(void* arg){
+  release_process((process*)arg);
 }
 
 //
@@ -174,6 +342,12 @@ int free_process( process* proc ) {
   // but for proxy kernel, it (memory leaking) may NOT be a really serious issue,
   // as it is different from regular OS, which needs to run 7x24.
   proc->status = ZOMBIE;
+  kinfo_update( proc, 0 );
+
+  // a parent blocked in do_wait (or do_thread_join) checks its children again
+  if( proc->parent ) wakeup( &proc->parent->child_exit );
+  // nobody is left to reap proc, it is released once no hart runs it any more
+  else queue_work( &proc->reap_work, reap_orphan, proc );
 
   return 0;
 }
@@ -182,158 +356,125 @@ int free_process( process* proc ) {
 // reallocate a process
 // 
 void realloc_process(int i) {
-  // 1. free procs[i]
-  for( int j=0; j<procs[i].total_mapped_region; ++ j ){
-    switch( procs[i].mapped_info[j].seg_type ){
-      case STACK_SEGMENT:   // free user stack
-      case CONTEXT_SEGMENT: // free trapframe
-      case DATA_SEGMENT:    // free data segment
-        user_vm_unmap(procs[i].pagetable, 
-                      procs[i].mapped_info[j].va, 
-                      procs[i].mapped_info[j].npages*PGSIZE, 
-                      1);   // 取消映射并释放物理页
-        break;
-      case CODE_SEGMENT:
-        user_vm_unmap(procs[i].pagetable, 
-                      procs[i].mapped_info[j].va,
-                      procs[i].mapped_info[j].npages*PGSIZE,
-                      0);   // 只取消映射，不释放代码段物理页
-        break;
-    }
-  }
-  free_page(procs[i].pagetable);
+  // 1. free the trapframe and the vm space of procs[i]. exec runs on the page table it
+  // replaces, with KERNEL_IN_USER_PT.
+  free_trapframe(&procs[i]);
+  kern_vm_switch();
+  mm_put(procs[i].mm);
 
   // 2. alloc proc[i]
   // init proc[i]'s vm space
   procs[i].trapframe = (trapframe *)alloc_page();  //trapframe, used to save context
   memset(procs[i].trapframe, 0, sizeof(trapframe));
+  mm_create(&procs[i]);
 
-  // page directory
-  procs[i].pagetable = (pagetable_t)alloc_page();
-  memset((void *)procs[i].pagetable, 0, PGSIZE);
-
-  // procs[i].kstack = (uint64)alloc_page() + PGSIZE;   //user kernel stack top
-  uint64 user_stack = (uint64)alloc_page();       //phisical address of user stack bottom
-  procs[i].trapframe->regs.sp = USER_STACK_TOP;  //virtual address of user stack top
-
-  // allocates a page to record memory regions (segments)
-  // procs[i].mapped_info = (mapped_region*)alloc_page();
-  memset( procs[i].mapped_info, 0, PGSIZE );
-
-  // map user stack in userspace
-  user_vm_map((pagetable_t)procs[i].pagetable, USER_STACK_TOP - PGSIZE, PGSIZE,
-    user_stack, prot_to_type(PROT_WRITE | PROT_READ, 1));
-  procs[i].mapped_info[0].va = USER_STACK_TOP - PGSIZE;
-  procs[i].mapped_info[0].npages = 1;
-  procs[i].mapped_info[0].seg_type = STACK_SEGMENT;
-
-  // map trapframe in user space (direct mapping as in kernel space).
-  user_vm_map((pagetable_t)procs[i].pagetable, (uint64)procs[i].trapframe, PGSIZE,
-    (uint64)procs[i].trapframe, prot_to_type(PROT_WRITE | PROT_READ, 0));
-  procs[i].mapped_info[1].va = (uint64)procs[i].trapframe;
-  procs[i].mapped_info[1].npages = 1;
-  procs[i].mapped_info[1].seg_type = CONTEXT_SEGMENT;
-
-  // map S-mode trap vector section in user space (direct mapping as in kernel space)
-  // we assume that the size of usertrap.S is smaller than a page.
-  user_vm_map((pagetable_t)procs[i].pagetable, (uint64)trap_sec_start, PGSIZE,
-    (uint64)trap_sec_start, prot_to_type(PROT_READ | PROT_EXEC, 0));
-  procs[i].mapped_info[2].va = (uint64)trap_sec_start;
-  procs[i].mapped_info[2].npages = 1;
-  procs[i].mapped_info[2].seg_type = SYSTEM_SEGMENT;
-
-  sprint("in alloc_proc. user frame 0x%lx, user stack 0x%lx, user kstack 0x%lx \n",
-    procs[i].trapframe, procs[i].trapframe->regs.sp, procs[i].kstack);
-
-  procs[i].total_mapped_region = 3;
+  memset(&procs[i].fp, 0, sizeof(fp_state));
+  procs[i].fp_cpu = -1;
   procs[i].tick_count = 0;
   procs[i].total_tick_count = 0;
-  procs[i].total_mem_count = 3;
+  procs[i].run_time = 0;
+  procs[i].total_mem_count = procs[i].mm->total_mapped_region;
   return;
 }
 
 //
 // implements fork syscal in kernel.
 // basic idea here is to first allocate an empty process (child), then duplicate the
-// context and data segments of parent process to the child, and lastly, map other
-// segments (code, system) of the parent to child. the stack segment remains unchanged
-// for the child.
+// context of parent process to the child, and lastly, map other segments of the parent
+// to child. code pages are shared read-only, while data and stack pages are shared
+// copy-on-write: nothing is copied until the parent or the child stores to a page.
 //
 int do_fork( process* parent)
 {
   sprint( "will fork a child from parent %d.\n", parent->pid );
   process* child = alloc_process();
 
-  for( int i=0; i<parent->total_mapped_region; i++ ){
+  // the child starts with the FP state of the parent
+  fp_flush(parent);
+  child->fp = parent->fp;
+
+  for( int i=0; i<parent->mm->total_mapped_region; i++ ){
     // browse parent's vm space, and copy its trapframe and data segments,
     // map its code segment.
-    switch( parent->mapped_info[i].seg_type ){
+    switch( parent->mm->mapped_info[i].seg_type ){
       case CONTEXT_SEGMENT:
         *child->trapframe = *parent->trapframe;
         break;
       case STACK_SEGMENT:
-        memcpy( (void*)lookup_pa(child->pagetable, child->mapped_info[0].va),
-          (void*)lookup_pa(parent->pagetable, parent->mapped_info[i].va), PGSIZE );
+        // give back the stack page alloc_process prepared, and share the parent's one
+        user_vm_unmap(child->mm->pagetable, child->mm->mapped_info[0].va, PGSIZE, 1);
+        user_vm_share_cow(parent->mm->pagetable, child->mm->pagetable, parent->mm->mapped_info[i].va,
+          parent->mm->mapped_info[i].npages*PGSIZE);
         break;
       case CODE_SEGMENT:
-        for( int j=0; j<parent->mapped_info[i].npages; j++ ){
-          uint64 addr = lookup_pa(parent->pagetable, parent->mapped_info[i].va+j*PGSIZE);
-
-          map_pages(child->pagetable, parent->mapped_info[i].va+j*PGSIZE, PGSIZE,
+        for( int j=0; j<parent->mm->mapped_info[i].npages; j++ ){
+          uint64 addr = lookup_pa(parent->mm->pagetable, parent->mm->mapped_info[i].va+j*PGSIZE);
+          // not paged in yet, the child reads the page from the file on its own
+          if( addr == 0 ) continue;
+
+          // the code page is shared, the child holds its own reference to it
+          get_page((void *)addr);
+          user_vm_map(child->mm->pagetable, parent->mm->mapped_info[i].va+j*PGSIZE, PGSIZE,
             addr, prot_to_type(PROT_WRITE | PROT_READ | PROT_EXEC, 1));
 
           sprint( "do_fork map code segment at pa:%lx of parent to child at va:%lx.\n",
-            addr, parent->mapped_info[i].va+j*PGSIZE );
+            addr, parent->mm->mapped_info[i].va+j*PGSIZE );
         }
         // after mapping, register the vm region (do not delete codes below!)
-        child->mapped_info[child->total_mapped_region].va = parent->mapped_info[i].va;
-        child->mapped_info[child->total_mapped_region].npages = 
-          parent->mapped_info[i].npages;
-        child->mapped_info[child->total_mapped_region].seg_type = CODE_SEGMENT;
-        child->total_mapped_region++;
+        child->mm->mapped_info[child->mm->total_mapped_region] = parent->mm->mapped_info[i];
+        child->mm->total_mapped_region++;
         break;
       case DATA_SEGMENT:
-        for ( int j = 0; j < parent->mapped_info[i].npages; ++ j ){
-          // 1. alloc pages for data segment
-          uint64 pa = (uint64)alloc_page();
-          uint64 addr = lookup_pa(parent->pagetable, parent->mapped_info[i].va+j*PGSIZE);
-          memcpy((void *)pa, (void *)addr, PGSIZE);
-          // 2. map the va -> pa
-          map_pages(child->pagetable, 
-                    parent->mapped_info[i].va+j*PGSIZE, 
-                    PGSIZE,
-                    pa, 
-                    prot_to_type(PROT_WRITE | PROT_READ, 1));
-        }
-        // 3. copy the data segment info
-        child->mapped_info[child->total_mapped_region].va = 
-          parent->mapped_info[i].va;
-        child->mapped_info[child->total_mapped_region].npages = 
-          parent->mapped_info[i].npages;
-        child->mapped_info[child->total_mapped_region].seg_type = DATA_SEGMENT;
-        ++ child->total_mapped_region;
+      case HEAP_SEGMENT:
+      case MMAP_SEGMENT:
+        // 1. share the data pages copy-on-write
+        user_vm_share_cow(parent->mm->pagetable, child->mm->pagetable, parent->mm->mapped_info[i].va,
+          parent->mm->mapped_info[i].npages*PGSIZE);
+        // 2. copy the data segment info
+        child->mm->mapped_info[child->mm->total_mapped_region] = parent->mm->mapped_info[i];
+        ++ child->mm->total_mapped_region;
+        break;
+      case RING_SEGMENT:
+        // the child gets syscall rings of its own, in the state of the parent's: its copy
+        // of the user memory that keeps track of them (user_lib's g_ring) says so
+        if( do_ring_setup(child) == 0 ) panic( "do_fork: cannot set up the syscall rings.\n" );
+        memcpy(child->mm->ring, parent->mm->ring, PGSIZE);
         break;
     }
   }
 
+  elf_share_file(child->mm, parent->mm);
+  child->mm->heap_top = parent->mm->heap_top;
+
   child->status = READY;
   child->trapframe->regs.a0 = 0;
   child->parent = parent;
 
-  child->tick_count = 0;
+  child->nice = parent->nice;
+  sched_new_process( child );
   child->total_tick_count = 0;
-  child->total_mem_count = child->total_mapped_region;
+  child->run_time = 0;
+  child->run_start = timer_now();
+  child->total_mem_count = child->mm->total_mapped_region;
   insert_to_ready_queue( child );
 
+  // the pages of parent are write-protected now, also for its threads on other harts
+  smp_tlb_shootdown( parent->mm );
+
   return child->pid;
 }
 
-int do_wait(int pid){
+//
+// reap a ZOMBIE child (pid, or any child if pid is -1) and return its pid, -1 if there
+// is no such child. blocks while the children are all still alive. threads are reaped
+// by do_thread_join, processes by do_wait.
+//
+static int wait_child(int pid, int thread){
   int havekids, child_pid;
   havekids = 0;
   // Scan through table looking for zombie children.
-  for ( int i = 0; i < NPROC; ++ i ){
-    if ( procs[i].parent != current ) // not my children
+  for ( int i = 0; i < g_nproc; ++ i ){
+    if ( procs[i].parent != current || procs[i].is_thread != thread ) // not my children
       continue;
     // my child but not that wanted
     if ( pid > 0 && pid != procs[i].pid )
@@ -343,35 +484,7 @@ int do_wait(int pid){
     if ( procs[i].status == ZOMBIE ){
 
       child_pid = procs[i].pid;
-
-      free_page((void*)procs[i].kstack-PGSIZE);  // 释放 kstack
-
-      for( int j=0; j<procs[i].total_mapped_region; ++ j ){
-        switch( procs[i].mapped_info[j].seg_type ){
-          case STACK_SEGMENT:   // free user stack
-          case CONTEXT_SEGMENT: // free trapframe
-          case DATA_SEGMENT:    // free data segment
-            user_vm_unmap(procs[i].pagetable, 
-                          procs[i].mapped_info[j].va, 
-                          procs[i].mapped_info[j].npages*PGSIZE, 
-                          1);   // 取消映射并释放物理页
-            break;
-          case CODE_SEGMENT:
-            user_vm_unmap(procs[i].pagetable, 
-                          procs[i].mapped_info[j].va,
-                          procs[i].mapped_info[j].npages*PGSIZE,
-                          0);   // 只取消映射，不释放代码段物理页
-            break;
-        }
-      }
-      free_page(procs[i].mapped_info);
-      free_page(procs[i].pagetable);
-      procs[i].status = FREE;
-      procs[i].parent = NULL;
-      procs[i].queue_next = NULL;
-      procs[i].tick_count = 0;
-      procs[i].total_mem_count = 0;
-      procs[i].total_tick_count = 0;
+      release_process(&procs[i]);
       return child_pid;
     }
   }
@@ -380,11 +493,89 @@ int do_wait(int pid){
     return -1;
   }
 
-  return -2;
+  // the children are still running: sleep until one of them exits, and then run the
+  // wait syscall again (its ecall, as epc has already been moved past it)
+  current->trapframe->epc -= 4;
+  sleep_on( &current->child_exit );
+  return -2;  // not reached
+}
+
+int do_wait(int pid){
+  return wait_child(pid, 0);
+}
+
+//
+// reap the thread tid, which current process has created with do_clone, once it has
+// exited. returns tid, or -1 if current process has no such thread.
+//
+int do_thread_join(int tid){
+  if ( tid <= 0 ) return -1;
+  return wait_child(tid, 1);
+}
+
+//
+// implements clone: start a thread of parent, which shares its address space and its
+// files, and runs from entry with stack pointer stack, and arg0 and arg1 in a0 and a1.
+// returns the pid (thread id) of the new thread.
+//
+int do_clone( process* parent, uint64 entry, uint64 arg0, uint64 arg1, uint64 stack )
+{
+  process* child = alloc_task();
+
+  child->mm = parent->mm;
+  child->mm->users++;
+  map_trapframe(child);
+  child->pfiles = parent->pfiles;
+  child->is_thread = 1;
+
+  // gp and tp are those of parent, the rest is set for entry
+  *child->trapframe = *parent->trapframe;
+  child->trapframe->epc = entry;
+  child->trapframe->regs.sp = stack;
+  child->trapframe->regs.ra = 0;
+  child->trapframe->regs.a0 = arg0;
+  child->trapframe->regs.a1 = arg1;
+
+  child->status = READY;
+  child->parent = parent;
+  child->nice = parent->nice;
+  sched_new_process( child );
+  insert_to_ready_queue( child );
+
+  return child->pid;
+}
+
+//
+// implements spawn syscall in kernel: a child process of current is built directly from
+// the elf of the shell command argv[0], with argv on its stack, instead of copying the
+// address space of current by fork only to replace it by exec. returns the pid of the
+// child, or -1 if the command cannot be loaded.
+//
+int do_spawn(char * path, char ** argv){
+  process* child = alloc_process();
+
+  if ( spawn_shell_bincode_from_host_elf(child, (uint64)argv) != 0 ){
+    // the child has not run, the files_struct alloc_process gave it is its own
+    files_destroy(child->pfiles);
+    child->pfiles = NULL;
+    release_process(child);
+    return -1;
+  }
+
+  child->status = READY;
+  child->parent = current;
+  child->nice = current->nice;
+  sched_new_process( child );
+  child->total_mem_count = child->mm->total_mapped_region;
+  insert_to_ready_queue( child );
+
+  return child->pid;
 }
 
 int do_exec(char * path, char ** argv){
-  load_shell_bincode_from_host_elf(user_va_to_pa(current->pagetable, argv));
+  // exec would pull the address space from under the other threads of the process
+  if ( current->mm->users > 1 ) return -1;
+  if ( load_shell_bincode_from_host_elf((uint64)argv) != 0 ) return -1;
   return 1; 
 }
 
@@ -392,7 +583,7 @@ int do_getinfo(){
   sprint("top - \n");
   // process status
   int nprocs[5] = {0};
-  for ( int i = 0; i < NPROC; ++ i ){
+  for ( int i = 0; i < g_nproc; ++ i ){
     if ( procs[i].status != FREE ){
       ++ nprocs[0];
       ++ nprocs[procs[i].status];
@@ -405,10 +596,17 @@ int do_getinfo(){
 
   sprint("KiB Mem: %d\n", (g_mem_size >> 10));
 
-  sprint("\nPID\tS\tMEM\tTICK\n");
-  int pid, tick, mem;
+  // the share of the CPU each runnable process is entitled to, by its weight
+  int total_weight = 0;
+  for ( int i = 0; i < g_nproc; ++ i )
+    if ( procs[i].status == READY || procs[i].status == RUNNING )
+      total_weight += sched_nice_to_weight(procs[i].nice);
+
+  // SHARE and CPU are in percent: entitled by weight, and actually used so far
+  sprint("\nPID\tS\tNI\tSHARE\tCPU\tMEM\tTICK\n");
+  int pid, tick, mem, share, cpu;
   char stat;
-  for ( int i = 0; i < NPROC; ++ i ){
+  for ( int i = 0; i < g_nproc; ++ i ){
     if ( procs[i].status != FREE ){
       pid = procs[i].pid;
       stat = '/';
@@ -419,9 +617,143 @@ int do_getinfo(){
         case ZOMBIE:  stat = 'Z'; break;
       }
       mem = procs[i].total_mem_count * 4;
-      tick = procs[i].total_tick_count;
-      sprint("%d\t%c\t%d\t%d\n", pid, stat, mem, tick);
+      tick = timer_run_ticks(&procs[i]);
+      share = 0;
+      if ( procs[i].status == READY || procs[i].status == RUNNING )
+        share = sched_nice_to_weight(procs[i].nice) * 100 / total_weight;
+      cpu = g_ticks ? tick * 100 / g_ticks : 0;
+      sprint("%d\t%c\t%d\t%d\t%d\t%d\t%d\n", pid, stat, procs[i].nice, share, cpu, mem, tick);
     }
   }
   return 1;
-}
\ No newline at end of file
+}
+
+//
+// returns an unused entry of p->mm->mapped_info, reusing the entries of unmapped ranges.
+// 0 if there is none left.
+//
+mapped_region *new_mapped_region(process *p) {
+  for (int i = 0; i < p->mm->total_mapped_region; i++)
+    if (p->mm->mapped_info[i].npages == 0) return &p->mm->mapped_info[i];
+
+  if (p->mm->total_mapped_region >= PGSIZE / sizeof(mapped_region)) return 0;
+  return &p->mm->mapped_info[p->mm->total_mapped_region++];
+}
+
+//
+// back [va, va+size] of p with zeroed pages, one page table update per page.
+// returns 0 on success, -1 (with nothing mapped) if memory runs out.
+//
+static int map_anonymous(process *p, uint64 va, uint64 size) {
+  for (uint64 a = va; a < va + size; a += PGSIZE) {
+    void *pa = alloc_page();
+    if (pa == 0) {
+      user_vm_unmap(p->mm->pagetable, va, a - va, 1);
+      return -1;
+    }
+    memset(pa, 0, PGSIZE);
+    user_vm_map(p->mm->pagetable, a, PGSIZE, (uint64)pa, prot_to_type(PROT_WRITE | PROT_READ, 1));
+  }
+  return 0;
+}
+
+//
+// implements sbrk: moves the end of the heap of current process by increment bytes,
+// mapping or unmapping whole pages as the break crosses them.
+// returns the previous break, or -1 on failure.
+//
+uint64 do_sbrk(int64 increment) {
+  uint64 old_top = current->mm->heap_top, new_top = old_top + increment;
+  if (new_top < USER_HEAP_START || new_top > USER_MMAP_START) return -1;
+
+  mapped_region *heap = 0;
+  for (int i = 0; i < current->mm->total_mapped_region; i++)
+    if (current->mm->mapped_info[i].seg_type == HEAP_SEGMENT) heap = &current->mm->mapped_info[i];
+  if (heap == 0) {
+    if ((heap = new_mapped_region(current)) == 0) return -1;
+    heap->va = USER_HEAP_START;
+    heap->npages = 0;
+    heap->seg_type = HEAP_SEGMENT;
+  }
+
+  uint64 old_end = ROUNDUP(old_top, PGSIZE), new_end = ROUNDUP(new_top, PGSIZE);
+  if (new_end > old_end && map_anonymous(current, old_end, new_end - old_end) != 0) return -1;
+  if (new_end < old_end) {
+    user_vm_unmap(current->mm->pagetable, new_end, old_end - new_end, 1);
+    smp_tlb_shootdown(current->mm);
+  }
+
+  heap->npages = (new_end - USER_HEAP_START) / PGSIZE;
+  current->mm->heap_top = new_top;
+  return old_top;
+}
+
+//
+// implements anonymous mmap: maps length bytes (rounded up to whole pages) of zeroed
+// memory at the lowest free address of the mmap area of current process.
+// returns the start of the range, or -1 on failure.
+//
+uint64 do_mmap(uint64 length) {
+  uint64 size = ROUNDUP(length, PGSIZE);
+  if (length == 0 || size > USER_MMAP_END - USER_MMAP_START) return -1;
+
+  // first fit: step over the ranges that overlap the candidate until none does
+  uint64 va = USER_MMAP_START;
+  for (int i = 0; i < current->mm->total_mapped_region; i++) {
+    mapped_region *r = &current->mm->mapped_info[i];
+    if (r->seg_type != MMAP_SEGMENT || r->npages == 0) continue;
+    if (va < r->va + (uint64)r->npages * PGSIZE && r->va < va + size) {
+      va = r->va + (uint64)r->npages * PGSIZE;
+      i = -1;
+    }
+  }
+  if (va + size > USER_MMAP_END) return -1;
+
+  mapped_region *r = new_mapped_region(current);
+  if (r == 0 || map_anonymous(current, va, size) != 0) return -1;
+  r->va = va;
+  r->npages = size / PGSIZE;
+  r->seg_type = MMAP_SEGMENT;
+  return va;
+}
+
+//
+// implements munmap: unmaps the pages of [va, va+length] that belong to mmap ranges of
+// current process. a range may be trimmed at either end, or split in two.
+// returns 0, or -1 if no page of [va, va+length] was mapped by mmap.
+//
+int do_munmap(uint64 va, uint64 length) {
+  if (va % PGSIZE != 0) return -1;
+  uint64 end = va + ROUNDUP(length, PGSIZE);
+
+  int n = current->mm->total_mapped_region, unmapped = 0;
+  for (int i = 0; i < n; i++) {
+    mapped_region *r = &current->mm->mapped_info[i];
+    if (r->seg_type != MMAP_SEGMENT || r->npages == 0) continue;
+
+    uint64 r_end = r->va + (uint64)r->npages * PGSIZE;
+    uint64 lo = MAX(va, r->va), hi = MIN(end, r_end);
+    if (lo >= hi) continue;
+
+    user_vm_unmap(current->mm->pagetable, lo, hi - lo, 1);
+    unmapped = 1;
+    if (lo == r->va && hi == r_end) {
+      r->npages = 0;
+    } else if (lo == r->va) {
+      r->va = hi;
+      r->npages = (r_end - hi) / PGSIZE;
+    } else {
+      r->npages = (lo - r->va) / PGSIZE;
+      if (hi < r_end) {
+        mapped_region *tail = new_mapped_region(current);
+        if (tail == 0) panic("do_munmap: too many mapped regions.\n");
+        tail->va = hi;
+        tail->npages = (r_end - hi) / PGSIZE;
+        tail->seg_type = MMAP_SEGMENT;
+      }
+    }
+  }
+  if (!unmapped) return -1;
+  smp_tlb_shootdown(current->mm);
+  return 0;
+}
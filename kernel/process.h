@@ -2,6 +2,8 @@
 #define _PROC_H_
 
 #include "riscv.h"
+#include "smp.h"
+#include "workqueue.h"
 
 typedef struct trapframe {
   // space to store context (all common registers)
@@ -16,9 +18,24 @@ typedef struct trapframe {
 
   //kernel page table
   /* offset:272 */ uint64 kernel_satp;
+  // id of the hart the process runs on, restored to tp on kernel entry
+  /* offset:280 */ uint64 kernel_hartid;
+
+  // timer fast path of smode_trap_vector (see timer.c): ticks it may still take, the
+  // time its next tick must not pass, ticks it has taken and the deadline it last set
+  /* offset:288 */ uint64 fast_ticks;
+  /* offset:296 */ uint64 fast_limit;
+  /* offset:304 */ uint64 fast_taken;
+  /* offset:312 */ uint64 fast_deadline;
 }trapframe;
 
-// PKE kernel supports at most 32 processes
+// floating-point registers and fcsr of a process, saved lazily (see fp.c)
+typedef struct fp_state {
+  /* offset:0   */ uint64 f[32];
+  /* offset:256 */ uint64 fcsr;
+} fp_state;
+
+// PKE kernel supports 32 processes by default, the kernel option --nproc=N changes it
 #define NPROC 32
 
 // possible status of a process
@@ -37,6 +54,9 @@ enum segment_type {
   STACK_SEGMENT,   // runtime segment
   CONTEXT_SEGMENT, // trapframe segment
   SYSTEM_SEGMENT,  // system segment
+  HEAP_SEGMENT,    // runtime segment, grown and shrunk by sbrk
+  MMAP_SEGMENT,    // runtime segment, an anonymous mmap range
+  RING_SEGMENT,    // runtime segment, the syscall rings
 };
 
 // the VM regions mapped to a user process
@@ -44,21 +64,52 @@ typedef struct mapped_region {
   uint64 va;       // mapped virtual address
   uint32 npages;   // mapping_info is unused if npages == 0
   uint32 seg_type; // segment type, one of the segment_types
+
+  // ELF segments (code, data): the file contents to be placed at file_va. bytes of the
+  // region beyond file_va + file_sz are zero-filled (bss).
+  uint64 file_va;
+  uint64 file_off;
+  uint64 file_sz;
 } mapped_region;
 
-// the extremely simple definition of process, used for begining labs of PKE
-typedef struct process {
-  // pointing to the stack used in trap handling.
-  uint64 kstack;
+// a FIFO of processes BLOCKED on some event, linked through process.wait_next. see
+// sleep_on and wakeup in sched.c
+typedef struct wait_queue {
+  struct process *head;
+  struct process *tail;
+} wait_queue;
+
+// the address space of a process, shared by its threads (see do_clone)
+typedef struct mm_struct {
   // user page table
   pagetable_t pagetable;
-  // trapframe storing the context of a (User mode) process.
-  trapframe* trapframe;
+  // address space identifier (with its generation), see asid_get
+  uint64 asid;
 
   // points to a page that contains mapped_regions
   mapped_region *mapped_info;
   // next free mapped region in mapped_info
   int total_mapped_region;
+  // current end (break) of the heap segment
+  uint64 heap_top;
+
+  // host ELF file that the code and data segments are paged in from, if demand-paged
+  struct exec_file_t *exec_file;
+  // syscall rings shared with the process, NULL until it sets them up
+  struct syscall_ring *ring;
+
+  // number of processes (threads) sharing the address space, freed with the last one
+  int users;
+  // deferred freeing of the address space, see mm_put
+  work_struct free_work;
+} mm_struct;
+
+// the extremely simple definition of process, used for begining labs of PKE
+typedef struct process {
+  // address space, shared with the threads of the process
+  mm_struct *mm;
+  // trapframe storing the context of a (User mode) process.
+  trapframe* trapframe;
 
   // process id
   uint64 pid;
@@ -66,23 +117,56 @@ typedef struct process {
   int status;
   // parent process
   struct process *parent;
-  // next queue element
+  // next and previous elements in the ready queue, valid while on_rq is set
   struct process *queue_next;
+  struct process *queue_prev;
+  int on_rq;
+  // next element in the wait queue the process sleeps on
+  struct process *wait_next;
+  // where the process sleeps in do_wait, until one of its children exits
+  wait_queue child_exit;
+  // time the process sleeps until, see timer_sleep
+  uint64 sleep_deadline;
+
+  // scheduling: nice value (NICE_MIN..NICE_MAX), the MLFQ level, and the CFS virtual
+  // runtime with the slot in the CFS run queue
+  int nice;
+  int sched_level;
+  uint64 vruntime;
+  int heap_index;
+  // hart whose ready queue the process is (or was last) on, and hart it last ran on
+  int cpu;
+  int last_cpu;
 
   // accounting
   int tick_count;
 
   int total_tick_count;
   int total_mem_count;
-
-  // file
+  // time spent on a hart since the process started, and since when it is still to be
+  // charged (see timer_account). total_tick_count is its whole TIMER_INTERVALs.
+  uint64 run_time;
+  uint64 run_start;
+  // the status the kernel info page counts the process under (see kinfo_update)
+  int kinfo_status;
+
+  // file, shared with the threads of the process
   struct files_struct * pfiles;
+
+  // a thread created by do_clone, reaped by do_thread_join instead of do_wait
+  int is_thread;
+  // releases the process when it exits with no parent left to reap it
+  work_struct reap_work;
+
+  // floating-point state, and the hart whose FP registers hold it (-1 for none)
+  fp_state fp;
+  int fp_cpu;
 }process;
 
 // switch to run user app
 void switch_to(process*);
-// initialize process pool (the procs[] array)
-void init_proc_pool();
+// initialize process pool (the procs[] array) of nproc processes
+void init_proc_pool(int nproc);
 // allocate an empty process, init its vm space. returns its pid
 process* alloc_process();
 // reclaim a process, destruct its vm space and free physical pages.
@@ -91,16 +175,28 @@ int free_process( process* proc );
 void realloc_process(int i);
 // fork a child from parent
 int do_fork(process* parent);
+// start a thread of parent, sharing its address space and files
+int do_clone(process* parent, uint64 entry, uint64 arg0, uint64 arg1, uint64 stack);
 // wait for a child
 int do_wait(int pid);
+// wait for a thread created by current process
+int do_thread_join(int tid);
 // exec
 int do_exec(char * path, char ** argv);
+int do_spawn(char * path, char ** argv);
 // get info
 int do_getinfo();
-
-// current running process
-extern process* current;
-// virtual address of our simple heap
-extern uint64 g_ufree_page;
+// heap and anonymous memory ranges
+uint64 do_sbrk(int64 increment);
+uint64 do_mmap(uint64 length);
+int do_munmap(uint64 va, uint64 length);
+// an unused entry of the mapped regions of p, 0 if there is none left
+mapped_region *new_mapped_region(process *p);
+
+// process running on this hart
+#define current (g_cpus[cpuid()].proc)
+// process pool, and its size
+extern process* procs;
+extern int g_nproc;
 
 #endif
@@ -55,12 +55,16 @@
 // irqs (interrupts)
 #define CAUSE_MTIMER 0x8000000000000007
 #define CAUSE_MTIMER_S_TRAP 0x8000000000000001
+#define CAUSE_STIMER_S_TRAP 0x8000000000000005
+#define CAUSE_MSOFT 0x8000000000000003
 
 //Supervisor interrupt-pending register
 #define SIP_SSIP (1L << 1)
+#define SIP_STIP (1L << 5)
 
 // core local interruptor (CLINT), which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4 * (hartid))
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8 * (hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8)  // cycles since boot.
 
@@ -72,6 +76,10 @@
 #define SSTATUS_UIE (1L << 0)   // User Interrupt Enable
 #define SSTATUS_SUM 0x00040000
 #define SSTATUS_FS 0x00006000
+#define SSTATUS_FS_OFF 0x00000000      // FP unit off, FP instructions are illegal
+#define SSTATUS_FS_INITIAL 0x00002000  // FP registers hold their initial values
+#define SSTATUS_FS_CLEAN 0x00004000    // FP registers unchanged since saved or loaded
+#define SSTATUS_FS_DIRTY 0x00006000    // FP registers written
 
 // Supervisor Interrupt Enable
 #define SIE_SEIE (1L << 9)  // external
@@ -117,6 +125,13 @@ static inline int supports_extension(char ext) {
     __tmp;                                                            \
   })
 
+#define clear_csr(reg, bit)                                           \
+  ({                                                                  \
+    unsigned long __tmp;                                              \
+    asm volatile("csrrc %0, " #reg ", %1" : "=r"(__tmp) : "rK"(bit)); \
+    __tmp;                                                            \
+  })
+
 // enable device interrupts
 static inline void intr_on(void) { write_csr(sstatus, read_csr(sstatus) | SSTATUS_SIE); }
 
@@ -148,12 +163,29 @@ static inline uint64 read_tp(void) {
 static inline void write_tp(uint64 x) { asm volatile("mv tp, %0" : : "r"(x)); }
 
 static inline void flush_tlb(void) { asm volatile("sfence.vma zero, zero"); }
+
+// invalidate the translations of one address space (asid), or of one page (va) in all of them
+static inline void flush_tlb_asid(uint64 asid) {
+  asm volatile("sfence.vma zero, %0" : : "r"(asid) : "memory");
+}
+static inline void flush_tlb_page(uint64 va) {
+  asm volatile("sfence.vma %0, zero" : : "r"(va) : "memory");
+}
 #define PGSIZE 4096  // bytes per page
 #define PGSHIFT 12   // bits of offset within a page
 
 // use riscv's sv39 page table scheme.
 #define SATP_SV39 (8L << 60)
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
+// satp with an address space identifier, so its translations survive switching satp
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID_MASK (0xffffL << SATP_ASID_SHIFT)
+#define MAKE_SATP_ASID(pagetable, asid) (MAKE_SATP(pagetable) | ((uint64)(asid) << SATP_ASID_SHIFT))
+
+// [m|s]counteren: allow the lower privilege mode to read cycle, time and instret
+#define COUNTEREN_CY (1 << 0)
+#define COUNTEREN_TM (1 << 1)
+#define COUNTEREN_IR (1 << 2)
 
 #define PTE_V (1L << 0)  // valid
 #define PTE_R (1L << 1)
@@ -163,6 +195,7 @@ static inline void flush_tlb(void) { asm volatile("sfence.vma zero, zero"); }
 #define PTE_G (1L << 5)  // Global
 #define PTE_A (1L << 6)  // Accessed
 #define PTE_D (1L << 7)  // Dirty
+#define PTE_COW (1L << 8)  // (software, RSW) copy-on-write page, shared read-only
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -175,6 +208,10 @@ static inline void flush_tlb(void) { asm volatile("sfence.vma zero, zero"); }
 #define PXMASK 0x1FF  // 9 bits
 #define PXSHIFT(level) (PGSHIFT + (9 * (level)))
 #define PX(level, va) ((((uint64)(va)) >> PXSHIFT(level)) & PXMASK)
+// bytes mapped by a leaf PTE at a level: 4KB page (0), 2MB megapage (1), 1GB gigapage (2)
+#define PGSIZE_LEVEL(level) (1L << PXSHIFT(level))
+// a valid PTE with any of R/W/X set is a leaf, otherwise it points to the next level
+#define PTE_LEAF(pte) ((pte) & (PTE_R | PTE_W | PTE_X))
 // one beyond the highest possible virtual address.
 // MAXVA is actually one bit less than the max allowed by
 // Sv39, to avoid having to sign-extend virtual addresses
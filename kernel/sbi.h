@@ -0,0 +1,24 @@
+#ifndef _SBI_H_
+#define _SBI_H_
+
+#include "util/types.h"
+
+// calls from the S-mode kernel to M-mode, made with ecall (handled in
+// kernel/machine/mtrap.c): a7 holds the function, a0 its argument. numbered after the
+// legacy SBI.
+#define SBI_SET_TIMER 0
+#define SBI_SEND_IPI 4
+
+static inline void sbi_call(uint64 func, uint64 arg) {
+  register uint64 a0 asm("a0") = arg;
+  register uint64 a7 asm("a7") = func;
+  asm volatile("ecall" : "+r"(a0) : "r"(a7) : "memory");
+}
+
+// fire the timer interrupt of this hart once mtime reaches deadline, never if it is -1
+static inline void sbi_set_timer(uint64 deadline) { sbi_call(SBI_SET_TIMER, deadline); }
+
+// raise a supervisor software interrupt on hart hartid
+static inline void sbi_send_ipi(int hartid) { sbi_call(SBI_SEND_IPI, hartid); }
+
+#endif
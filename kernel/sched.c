@@ -3,36 +3,236 @@
  */
 
 #include "sched.h"
+#include "config.h"
+#include "cmdline.h"
+#include "timer.h"
+#include "sbi.h"
+#include "kinfo.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "fp.h"
+#include "workqueue.h"
+#include "util/string.h"
+#include "util/functions.h"
 #include "spike_interface/spike_utils.h"
 
-process* ready_queue_head = NULL;
+// the policy in use, selected by sched_init
+static const sched_class* g_sched_class = &rr_sched_class;
+
+static const sched_class* sched_classes[] = {
+  &rr_sched_class, &mlfq_sched_class, &cfs_sched_class,
+};
+
+//
+// append a process, p, to the END of run queue rq.
+//
+void rq_push_tail( run_queue* rq, process* p ) {
+  p->on_rq = 1;
+  p->queue_next = NULL;
+  p->queue_prev = rq->tail;
+  if( rq->tail ) rq->tail->queue_next = p;
+  else rq->head = p;
+  rq->tail = p;
+}
+
+//
+// take a process, p, out of run queue rq, wherever it is.
+//
+void rq_remove( run_queue* rq, process* p ) {
+  if( p->queue_prev ) p->queue_prev->queue_next = p->queue_next;
+  else rq->head = p->queue_next;
+  if( p->queue_next ) p->queue_next->queue_prev = p->queue_prev;
+  else rq->tail = p->queue_prev;
+
+  p->queue_next = p->queue_prev = NULL;
+  p->on_rq = 0;
+}
+
+//
+// select the scheduling policy named by the kernel option --sched=, or SCHED_POLICY.
+//
+void sched_init() {
+  const char* name = cmdline_option( "sched" );
+  if( name == NULL ) name = SCHED_POLICY;
+
+  for( int i = 0; i < ARRAY_SIZE(sched_classes); i++ )
+    if( strcmp(sched_classes[i]->name, name) == 0 ) g_sched_class = sched_classes[i];
+
+  if( strcmp(g_sched_class->name, name) != 0 )
+    sprint( "unknown scheduling policy %s, using %s.\n", name, g_sched_class->name );
+  sprint( "scheduling policy: %s\n", g_sched_class->name );
+
+  if( g_sched_class->init ) g_sched_class->init( g_nproc );
+}
+
+//
+// name of the scheduling policy in use.
+//
+const char* sched_policy() { return g_sched_class->name; }
 
 //
-// insert a process, proc, into the END of ready queue.
+// the online hart with the least work (ready and running processes), preferring this one.
+//
+static int sched_select_cpu() {
+  int best = cpuid(), best_load = NCPU * g_nproc;
+  for( int c = 0; c < NCPU; c++ ){
+    if( !g_cpus[c].online && c != cpuid() ) continue;
+    int load = g_cpus[c].nr_ready + (g_cpus[c].proc != NULL);
+    if( load < best_load || (load == best_load && c == cpuid()) ){
+      best = c;
+      best_load = load;
+    }
+  }
+  return best;
+}
+
+//
+// place a new (or forked) process on a hart, and let the policy set up its bookkeeping.
+//
+void sched_new_process( process* proc ) {
+  proc->tick_count = 0;
+  proc->cpu = sched_select_cpu();
+  g_sched_class->task_new( proc );
+}
+
+//
+// insert a process, proc, into the ready queue(s) of its hart.
 //
 void insert_to_ready_queue( process* proc ) {
   sprint( "going to insert process %d to ready queue.\n", proc->pid );
-  // if the queue is empty in the beginning
-  if( ready_queue_head == NULL ){
-    proc->status = READY;
-    proc->queue_next = NULL;
-    ready_queue_head = proc;
-    return;
+  proc->status = READY;
+  kinfo_update( proc, 0 );
+  if( proc->on_rq ) return;  //already in queue
+  g_cpus[proc->cpu].nr_ready++;
+  g_sched_class->enqueue( proc );
+
+  // that hart may be idle in wfi, or run its process with no timer set (see timer.c)
+  if( proc->cpu != cpuid() ) sbi_send_ipi( proc->cpu );
+}
+
+//
+// take a process, proc, out of the ready queue(s), wherever it is.
+//
+void remove_from_ready_queue( process* proc ) {
+  if( !proc->on_rq ) return;
+  g_cpus[proc->cpu].nr_ready--;
+  g_sched_class->dequeue( proc );
+}
+
+//
+// take the next process to run on this hart out of its ready queue(s). when they have
+// run dry, steal one from another hart. NULL if no hart has a ready process.
+//
+static process* pick_next_process() {
+  int self = cpuid();
+  for( int i = 0; i < NCPU; i++ ){
+    int c = (self + i) % NCPU;
+    if( g_cpus[c].nr_ready == 0 ) continue;
+
+    process* p = g_sched_class->pick_next( c );
+    if( p == NULL ) continue;
+    g_cpus[c].nr_ready--;
+    p->cpu = self;
+    return p;
   }
+  return NULL;
+}
+
+//
+// charge the time current process has run since it was last charged to it, tick by tick
+// for the policy. returns nonzero if the policy says its time slice is over.
+//
+int sched_account() {
+  int ticks = timer_account( current ), preempt = 0;
+  if( ticks == 0 ) return 0;
+  while( ticks-- > 0 ) preempt |= g_sched_class->tick( current );
+  kinfo_update( current, 0 );
+  return preempt;
+}
 
-  // ready queue is not empty
-  process *p;
-  // browse the ready queue to see if proc is already in-queue
-  for( p=ready_queue_head; p->queue_next!=NULL; p=p->queue_next )
-    if( p == proc ) return;  //already in queue
+int sched_ticks_left( process* p ) {
+  return g_sched_class->ticks_left ? g_sched_class->ticks_left( p ) : 0;
+}
 
-  // p points to the last element of the ready queue
-  if( p==proc ) return;
-  p->queue_next = proc;
-  proc->status = READY;
-  proc->queue_next = NULL;
+//
+// change the nice value of process pid (current process if pid is -1).
+// returns 0 on success, -1 on a bad pid or nice value.
+//
+int sched_setpriority( int pid, int nice ) {
+  if( pid < -1 || pid >= g_nproc ) return -1;
+  process* p = pid == -1 ? current : &procs[pid];
+  if( p->status == FREE || p->status == ZOMBIE ) return -1;
+  if( nice < NICE_MIN || nice > NICE_MAX ) return -1;
+
+  int queued = p->on_rq;
+  if( queued ) g_sched_class->dequeue( p );
+  p->nice = nice;
+  if( g_sched_class->set_nice ) g_sched_class->set_nice( p, nice );
+  if( queued ) g_sched_class->enqueue( p );
+  kinfo_update( p, 0 );
+  return 0;
+}
+
+/* --- round-robin policy --- */
+static run_queue rr_queue[NCPU];
+
+static void rr_task_new( process* p ) {}
+
+static void rr_enqueue( process* p ) { rq_push_tail( &rr_queue[p->cpu], p ); }
+
+static void rr_dequeue( process* p ) { rq_remove( &rr_queue[p->cpu], p ); }
+
+static process* rr_pick_next( int cpu ) {
+  process* p = rr_queue[cpu].head;
+  if( p ) rq_remove( &rr_queue[cpu], p );
+  return p;
+}
+
+//
+// a process runs for TIME_SLICE_LEN ticks, then goes to the END of the ready queue.
+//
+static int rr_tick( process* p ) {
+  if( ++ p->tick_count < TIME_SLICE_LEN ) return 0;
+  p->tick_count = 0;
+  return 1;
+}
+
+static int rr_ticks_left( process* p ) { return TIME_SLICE_LEN - 1 - p->tick_count; }
+
+const sched_class rr_sched_class = {
+  .name = "rr",
+  .init = NULL,
+  .task_new = rr_task_new,
+  .enqueue = rr_enqueue,
+  .dequeue = rr_dequeue,
+  .pick_next = rr_pick_next,
+  .tick = rr_tick,
+  .ticks_left = rr_ticks_left,
+  .set_nice = NULL,
+};
+
+//
+// idle this hart until the next interrupt, with the kernel left to the other harts. the
+// trap vector only takes traps from user mode, so interrupts stay disabled in sstatus:
+// wfi returns on a pending one all the same, and it is handled right here. a hart that
+// makes a process ready on this one interrupts it (see insert_to_ready_queue).
+//
+static void sched_idle() {
+  current = NULL;
+  // the page table of the last process may be freed while this hart idles
+  if( KERNEL_IN_USER_PT ) kern_vm_switch();
+  // an idle hart works on the deferred work first (see workqueue.c)
+  if( run_work( -1 ) ) return;
+#if PMM_LAZY_INIT && PMM_DEFERRED_INIT
+  // and on free memory, as timer interrupts may not come while processes run alone
+  if( pmm_deferred_init() ) return;
+#endif
+  timer_program();
+  kernel_unlock();
+  asm volatile( "wfi" );
+  kernel_lock();
 
-  return;
+  if( read_csr( sip ) & (SIP_SSIP | SIP_STIP) ) timer_interrupt();
 }
 
 //
@@ -41,33 +241,73 @@ void insert_to_ready_queue( process* proc ) {
 // process is still runnable, you should place it into the ready queue (by calling
 // ready_queue_insert), and then call schedule().
 //
-extern process procs[NPROC];
 void schedule() {
-  if ( !ready_queue_head ){
+  process *prev = current, *next;
+  // save the FP state of the process that leaves this hart, if it has changed
+  fp_leave();
+  while ( !(next = pick_next_process()) ){
     // by default, if there are no ready process, and all processes are in the status of
     // FREE and ZOMBIE, we should shutdown the emulated RISC-V machine.
     int should_shutdown = 1;
 
-    for( int i=0; i<NPROC; i++ )
+    for( int i=0; i<g_nproc; i++ )
       if( (procs[i].status != FREE) && (procs[i].status != ZOMBIE) ){
         should_shutdown = 0;
-        sprint( "ready queue empty, but process %d is not in free/zombie state:%d\n", 
-          i, procs[i].status );
+        break;
       }
 
     if( should_shutdown ){
+      kernel_lock_report();
       sprint( "no more ready processes, system shutdown now.\n" );
       shutdown( 0 );
-    }else{
-      panic( "Not handled: we should let system wait for unfinished processes.\n" );
     }
+
+    // the other processes are blocked, or running on other harts
+    sched_idle();
   }
 
-  current = ready_queue_head;
+  // next starts a time slice of its own on this hart, and its run time from now on: the
+  // time it spent ready or asleep is not charged to it
+  g_cpus[cpuid()].tick_deadline = 0;
+  next->run_start = timer_now();
+
+  current = next;
   assert( current->status == READY );
-  ready_queue_head = ready_queue_head->queue_next;
 
-  current->status == RUNNING;
+  current->status = RUNNING;
+  // the process that left this hart may have blocked or exited on its way here
+  if( prev && prev != next ) kinfo_update( prev, 0 );
+  kinfo_update( next, 1 );
   sprint( "going to schedule process %d to run.\n", current->pid );
   switch_to( current );
 }
+
+//
+// block the current process on wait queue wq, and run another one. never returns: once
+// woken up, the process goes on from its saved trapframe. so a syscall that sleeps
+// rewinds the epc of the process first, to be run again after the wakeup (see do_wait).
+//
+void sleep_on( wait_queue* wq ) {
+  current->status = BLOCKED;
+  current->wait_next = NULL;
+  if( wq->tail ) wq->tail->wait_next = current;
+  else wq->head = current;
+  wq->tail = current;
+
+  schedule();
+}
+
+//
+// make every process sleeping on wait queue wq ready again.
+//
+void wakeup( wait_queue* wq ) {
+  process* p = wq->head;
+  wq->head = wq->tail = NULL;
+
+  while( p ){
+    process* next = p->wait_next;
+    p->wait_next = NULL;
+    insert_to_ready_queue( p );
+    p = next;
+  }
+}
@@ -6,7 +6,57 @@
 //length of a time slice, in number of ticks
 #define TIME_SLICE_LEN  2
 
+// range of nice values, a lower value is favored by the scheduler
+#define NICE_MIN -20
+#define NICE_MAX 19
+
+// a FIFO of ready processes, linked through process.queue_next/queue_prev
+typedef struct run_queue {
+  process* head;
+  process* tail;
+} run_queue;
+
+void rq_push_tail( run_queue* rq, process* p );
+void rq_remove( run_queue* rq, process* p );
+
+// a scheduling policy. the policy owns the ready queue(s), one set per hart: a ready
+// process is queued on the hart given by its cpu field.
+typedef struct sched_class {
+  const char* name;
+  // set up the policy for a pool of nproc processes (may be NULL)
+  void (*init)( int nproc );
+  // p has been created, by alloc_process or fork
+  void (*task_new)( process* p );
+  // p becomes ready / leaves the ready queue(s)
+  void (*enqueue)( process* p );
+  void (*dequeue)( process* p );
+  // take the process to run next out of the ready queue(s) of hart cpu, NULL if none
+  process* (*pick_next)( int cpu );
+  // the running process p has been charged a tick, returns nonzero to preempt it
+  int (*tick)( process* p );
+  // the number of ticks the running process p can be charged before tick would preempt
+  // it, while no process becomes ready on its hart (may be NULL, for none)
+  int (*ticks_left)( process* p );
+  // the nice value of p has changed, called while p is not queued (may be NULL)
+  void (*set_nice)( process* p, int nice );
+} sched_class;
+
+extern const sched_class rr_sched_class;
+extern const sched_class mlfq_sched_class;
+extern const sched_class cfs_sched_class;
+
+int sched_nice_to_weight( int nice );
+
+void sched_init();
+const char* sched_policy();
+void sched_new_process( process* proc );
 void insert_to_ready_queue( process* proc );
+void remove_from_ready_queue( process* proc );
+int sched_account();
+int sched_ticks_left( process* p );
+int sched_setpriority( int pid, int nice );
 void schedule();
+void sleep_on( wait_queue* wq );
+void wakeup( wait_queue* wq );
 
 #endif
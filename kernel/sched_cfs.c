@@ -0,0 +1,154 @@
+/*
+ * fair-share (CFS-like) scheduling policy.
+ *
+ * every process accumulates virtual runtime: the ticks it ran, scaled down by its weight,
+ * which follows from its nice value (each nice step is worth about 10% of CPU time). the
+ * ready processes are kept in a binary min-heap keyed by vruntime, and the one that ran
+ * the least (virtually) runs next, so that CPU time is shared in proportion to weights.
+ * each hart has a heap (and a min_vruntime) of its own.
+ */
+
+#include "sched.h"
+#include "pmm.h"
+#include "util/string.h"
+#include "util/functions.h"
+#include "spike_interface/spike_utils.h"
+
+// weight of nice 0, and the vruntime a nice 0 process is charged per tick
+#define NICE_0_WEIGHT 1024
+#define CFS_TICK 1024
+// the running process is preempted once it is this far ahead of the leftmost one
+#define CFS_GRANULARITY (TIME_SLICE_LEN * CFS_TICK)
+
+// weights of nice -20 .. 19, as in Linux
+static const int cfs_weights[NICE_MAX - NICE_MIN + 1] = {
+  /* -20 */ 88761, 71755, 56483, 46273, 36291,
+  /* -15 */ 29154, 23254, 18705, 14949, 11916,
+  /* -10 */  9548,  7620,  6100,  4904,  3906,
+  /*  -5 */  3121,  2501,  1991,  1586,  1277,
+  /*   0 */  1024,   820,   655,   526,   423,
+  /*   5 */   335,   272,   215,   172,   137,
+  /*  10 */   110,    87,    70,    56,    45,
+  /*  15 */    36,    29,    23,    18,    15,
+};
+
+typedef struct cfs_rq {
+  // min-heap of ready processes, each knows its slot (heap_index)
+  process** heap;
+  int size;
+  // lower bound of the vruntime of runnable processes, never decreases
+  uint64 min_vruntime;
+} cfs_rq;
+
+static cfs_rq cfs_rqs[NCPU];
+
+int sched_nice_to_weight( int nice ) { return cfs_weights[nice - NICE_MIN]; }
+
+static void cfs_heap_set( cfs_rq* rq, int i, process* p ) {
+  rq->heap[i] = p;
+  p->heap_index = i;
+}
+
+static void cfs_sift_up( cfs_rq* rq, int i ) {
+  process* p = rq->heap[i];
+  while( i > 0 && rq->heap[(i - 1) / 2]->vruntime > p->vruntime ){
+    cfs_heap_set( rq, i, rq->heap[(i - 1) / 2] );
+    i = (i - 1) / 2;
+  }
+  cfs_heap_set( rq, i, p );
+}
+
+static void cfs_sift_down( cfs_rq* rq, int i ) {
+  process* p = rq->heap[i];
+  for( ;; ){
+    int c = 2 * i + 1;
+    if( c >= rq->size ) break;
+    if( c + 1 < rq->size && rq->heap[c + 1]->vruntime < rq->heap[c]->vruntime ) c++;
+    if( rq->heap[c]->vruntime >= p->vruntime ) break;
+    cfs_heap_set( rq, i, rq->heap[c] );
+    i = c;
+  }
+  cfs_heap_set( rq, i, p );
+}
+
+static void cfs_update_min_vruntime( cfs_rq* rq, process* running ) {
+  uint64 v = running ? running->vruntime : (uint64)-1;
+  if( rq->size > 0 ) v = MIN( v, rq->heap[0]->vruntime );
+  if( v != (uint64)-1 ) rq->min_vruntime = MAX( rq->min_vruntime, v );
+}
+
+static void cfs_init( int nproc ) {
+  for( int c = 0; c < NCPU; c++ ){
+    cfs_rqs[c].heap = (process**)alloc_pages( get_order(sizeof(process*) * nproc) );
+    if( cfs_rqs[c].heap == NULL ) panic( "cfs_init: cannot allocate the run queue.\n" );
+  }
+}
+
+//
+// a new process starts level with the others, so it neither waits long nor runs long.
+//
+static void cfs_task_new( process* p ) { p->vruntime = cfs_rqs[p->cpu].min_vruntime; }
+
+static void cfs_enqueue( process* p ) {
+  cfs_rq* rq = &cfs_rqs[p->cpu];
+  // a process that did not run for a while (or comes from another hart, whose vruntimes
+  // may lag behind) gets at most one granularity of credit
+  if( p->vruntime + CFS_GRANULARITY < rq->min_vruntime )
+    p->vruntime = rq->min_vruntime - CFS_GRANULARITY;
+
+  p->on_rq = 1;
+  rq->heap[rq->size++] = p;
+  cfs_sift_up( rq, rq->size - 1 );
+}
+
+static void cfs_dequeue( process* p ) {
+  cfs_rq* rq = &cfs_rqs[p->cpu];
+  int i = p->heap_index;
+  process* last = rq->heap[--rq->size];
+  p->on_rq = 0;
+  if( i == rq->size ) return;
+
+  cfs_heap_set( rq, i, last );
+  cfs_sift_up( rq, i );
+  cfs_sift_down( rq, last->heap_index );
+}
+
+static process* cfs_pick_next( int cpu ) {
+  cfs_rq* rq = &cfs_rqs[cpu];
+  if( rq->size == 0 ) return NULL;
+  process* p = rq->heap[0];
+  cfs_dequeue( p );
+  cfs_update_min_vruntime( rq, p );
+  return p;
+}
+
+static int cfs_tick( process* p ) {
+  cfs_rq* rq = &cfs_rqs[p->cpu];
+  p->vruntime += (uint64)CFS_TICK * NICE_0_WEIGHT / sched_nice_to_weight( p->nice );
+  cfs_update_min_vruntime( rq, p );
+
+  return rq->size > 0 && p->vruntime >= rq->heap[0]->vruntime + CFS_GRANULARITY;
+}
+
+static int cfs_ticks_left( process* p ) {
+  cfs_rq* rq = &cfs_rqs[p->cpu];
+  if( rq->size == 0 ) return 0;
+
+  // the ticks that keep vruntime below the preemption point
+  uint64 limit = rq->heap[0]->vruntime + CFS_GRANULARITY;
+  uint64 delta = (uint64)CFS_TICK * NICE_0_WEIGHT / sched_nice_to_weight( p->nice );
+  if( p->vruntime >= limit ) return 0;
+  return (limit - p->vruntime + delta - 1) / delta - 1;
+}
+
+const sched_class cfs_sched_class = {
+  .name = "cfs",
+  .init = cfs_init,
+  .task_new = cfs_task_new,
+  .enqueue = cfs_enqueue,
+  .dequeue = cfs_dequeue,
+  .pick_next = cfs_pick_next,
+  .tick = cfs_tick,
+  .ticks_left = cfs_ticks_left,
+  .set_nice = NULL,
+};
@@ -0,0 +1,118 @@
+/*
+ * multi-level feedback queue scheduling policy.
+ *
+ * a process starts at the highest level its nice value allows, and moves one level down
+ * each time it uses up the time slice of its level, which doubles at every level. yielding
+ * does not give a fresh slice, the ticks used at a level add up until the slice is used.
+ * a ready process at a higher level preempts the running one at the next tick, and every
+ * MLFQ_BOOST_PERIOD ticks all processes go back to their highest level, so that CPU-bound
+ * processes cannot starve, and processes that became interactive get their priority back.
+ */
+
+#include "sched.h"
+#include "util/functions.h"
+
+#define MLFQ_LEVELS 4
+#define MLFQ_BOOST_PERIOD 64
+
+// time slice of each level, in ticks
+static const int mlfq_slice[MLFQ_LEVELS] = { 1, 2, 4, 8 };
+
+// the queues of each hart, and the ticks of each hart since its last boost
+static run_queue mlfq_queue[NCPU][MLFQ_LEVELS];
+static int mlfq_ticks[NCPU];
+
+//
+// the highest level (0 being the highest) that a process of a nice value may be at.
+//
+static int mlfq_top_level( int nice ) {
+  return nice <= 0 ? 0 : nice * MLFQ_LEVELS / (NICE_MAX + 1);
+}
+
+static void mlfq_task_new( process* p ) { p->sched_level = mlfq_top_level( p->nice ); }
+
+static void mlfq_enqueue( process* p ) {
+  rq_push_tail( &mlfq_queue[p->cpu][p->sched_level], p );
+}
+
+static void mlfq_dequeue( process* p ) { rq_remove( &mlfq_queue[p->cpu][p->sched_level], p ); }
+
+static process* mlfq_pick_next( int cpu ) {
+  for( int l = 0; l < MLFQ_LEVELS; l++ ){
+    process* p = mlfq_queue[cpu][l].head;
+    if( p ){
+      rq_remove( &mlfq_queue[cpu][l], p );
+      return p;
+    }
+  }
+  return NULL;
+}
+
+//
+// move the running process, and every one ready on its hart, back to its highest level.
+//
+static void mlfq_boost( process* running ) {
+  run_queue* queue = mlfq_queue[running->cpu];
+  running->sched_level = mlfq_top_level( running->nice );
+  running->tick_count = 0;
+
+  for( int l = 1; l < MLFQ_LEVELS; l++ ){
+    process* p = queue[l].head;
+    while( p ){
+      process* next = p->queue_next;
+      int top = mlfq_top_level( p->nice );
+      p->tick_count = 0;
+      if( top < l ){
+        rq_remove( &queue[l], p );
+        p->sched_level = top;
+        rq_push_tail( &queue[top], p );
+      }
+      p = next;
+    }
+  }
+}
+
+static int mlfq_tick( process* p ) {
+  if( ++ mlfq_ticks[p->cpu] >= MLFQ_BOOST_PERIOD ){
+    mlfq_ticks[p->cpu] = 0;
+    mlfq_boost( p );
+  }
+
+  if( ++ p->tick_count >= mlfq_slice[p->sched_level] ){
+    if( p->sched_level < MLFQ_LEVELS - 1 ) p->sched_level++;
+    p->tick_count = 0;
+    return 1;
+  }
+
+  // a process is waiting at a higher level
+  for( int l = 0; l < p->sched_level; l++ )
+    if( mlfq_queue[p->cpu][l].head ) return 1;
+  return 0;
+}
+
+static int mlfq_ticks_left( process* p ) {
+  for( int l = 0; l < p->sched_level; l++ )
+    if( mlfq_queue[p->cpu][l].head ) return 0;
+
+  // stop short of the end of the slice, and of the next boost
+  int left = mlfq_slice[p->sched_level] - 1 - p->tick_count;
+  int boost = MLFQ_BOOST_PERIOD - 1 - mlfq_ticks[p->cpu];
+  return left < boost ? left : boost;
+}
+
+static void mlfq_set_nice( process* p, int nice ) {
+  p->sched_level = mlfq_top_level( nice );
+  p->tick_count = 0;
+}
+
+const sched_class mlfq_sched_class = {
+  .name = "mlfq",
+  .init = NULL,
+  .task_new = mlfq_task_new,
+  .enqueue = mlfq_enqueue,
+  .dequeue = mlfq_dequeue,
+  .pick_next = mlfq_pick_next,
+  .tick = mlfq_tick,
+  .ticks_left = mlfq_ticks_left,
+  .set_nice = mlfq_set_nice,
+};
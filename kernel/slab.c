@@ -0,0 +1,165 @@
+/*
+ * slab allocator for small kernel objects, built on top of the buddy allocator (pmm.c).
+ *
+ * each slab is a buddy block that begins with a slab header, followed by an array of
+ * free-object indexes (bufctl) and then the objects themselves. free objects are chained
+ * through bufctl rather than through the objects, so an object keeps the state its
+ * constructor gave it while it is cached.
+ */
+
+#include "slab.h"
+#include "pmm.h"
+#include "riscv.h"
+#include "util/types.h"
+#include "util/functions.h"
+#include "util/string.h"
+#include "spike_interface/spike_utils.h"
+
+#define BUFCTL_END 0xffff
+
+typedef struct slab {
+  struct kmem_cache *cache;  // owner of the slab
+  struct slab *next;         // neighbours in one of the cache's slab lists
+  struct slab *prev;
+  void *objs;                // address of the first object
+  int inuse;                 // number of objects handed out
+  uint16 free;               // index of the first free object, BUFCTL_END if none
+  uint16 bufctl[0];          // bufctl[i]: index of the free object following object i
+} slab;
+
+// descriptors of all caches
+static struct kmem_cache g_kmem_caches[KMEM_MAX_CACHES];
+static int g_nr_kmem_caches = 0;
+
+//
+// number of objects of "objsize" bytes that fit into a slab of 2^order pages
+//
+static int slab_capacity(uint64 objsize, int order) {
+  uint64 room = (PGSIZE << order) - sizeof(slab);
+  int n = room / (objsize + sizeof(uint16));
+  while (n > 0 && ROUNDUP(sizeof(slab) + n * sizeof(uint16), 8) + n * objsize > (PGSIZE << order))
+    n--;
+  return MIN(n, BUFCTL_END);
+}
+
+static void slab_list_add(slab **head, slab *s) {
+  s->prev = NULL;
+  s->next = *head;
+  if (*head) (*head)->prev = s;
+  *head = s;
+}
+
+static void slab_list_del(slab **head, slab *s) {
+  if (s->prev) s->prev->next = s->next;
+  else *head = s->next;
+  if (s->next) s->next->prev = s->prev;
+}
+
+//
+// create a cache of objects of "size" bytes. the slab order is the smallest one (up to
+// KMEM_MAX_SLAB_ORDER) that wastes at most 1/8 of the slab.
+//
+struct kmem_cache *kmem_cache_create(const char *name, uint64 size, void (*ctor)(void *)) {
+  if (g_nr_kmem_caches >= KMEM_MAX_CACHES)
+    panic("kmem_cache_create: too many caches (%s).\n", name);
+
+  struct kmem_cache *cache = &g_kmem_caches[g_nr_kmem_caches++];
+  memset(cache, 0, sizeof(*cache));
+  cache->name = name;
+  cache->objsize = ROUNDUP(MAX(size, 8), 8);
+  cache->ctor = ctor;
+
+  int order;
+  for (order = 0; order <= KMEM_MAX_SLAB_ORDER; order++) {
+    int n = slab_capacity(cache->objsize, order);
+    if (n > 0 && (PGSIZE << order) - n * cache->objsize <= (PGSIZE << order) / 8) break;
+  }
+  if (order > KMEM_MAX_SLAB_ORDER) order = KMEM_MAX_SLAB_ORDER;
+  cache->order = order;
+  cache->objs_per_slab = slab_capacity(cache->objsize, order);
+  if (cache->objs_per_slab == 0)
+    panic("kmem_cache_create: object of %s is too large (%ld bytes).\n", name, size);
+
+  return cache;
+}
+
+//
+// get a new slab from the buddy allocator, and construct all of its objects
+//
+static slab *slab_create(struct kmem_cache *cache) {
+  slab *s = (slab *)alloc_pages(cache->order);
+  if (s == NULL) return NULL;
+
+  int n = cache->objs_per_slab;
+  pa_to_page(s)->flags |= PG_slab;
+  s->cache = cache;
+  s->objs = (void *)s + ROUNDUP(sizeof(slab) + n * sizeof(uint16), 8);
+  s->inuse = 0;
+  s->free = 0;
+  for (int i = 0; i < n; i++) {
+    s->bufctl[i] = (i + 1 < n) ? i + 1 : BUFCTL_END;
+    if (cache->ctor) cache->ctor(s->objs + i * cache->objsize);
+  }
+
+  cache->nr_slabs++;
+  return s;
+}
+
+//
+// allocate an object from cache
+//
+void *kmem_cache_alloc(struct kmem_cache *cache) {
+  slab *s = cache->partial;
+  if (s == NULL) {
+    // prefer the cached empty slab, and only then grow the cache
+    if ((s = cache->empty) != NULL)
+      cache->empty = NULL;
+    else if ((s = slab_create(cache)) == NULL)
+      return NULL;
+    slab_list_add(&cache->partial, s);
+  }
+
+  void *obj = s->objs + s->free * cache->objsize;
+  s->free = s->bufctl[s->free];
+  s->inuse++;
+  cache->nr_active++;
+
+  if (s->free == BUFCTL_END) {
+    slab_list_del(&cache->partial, s);
+    slab_list_add(&cache->full, s);
+  }
+  return obj;
+}
+
+//
+// return an object to its cache
+//
+void kmem_cache_free(struct kmem_cache *cache, void *obj) {
+  // slabs are buddy blocks, which are aligned to their own size
+  slab *s = (slab *)ROUNDDOWN((uint64)obj, (uint64)PGSIZE << cache->order);
+  uint64 idx = (obj - s->objs) / cache->objsize;
+  if (s->cache != cache || obj < s->objs || idx >= cache->objs_per_slab ||
+      s->objs + idx * cache->objsize != obj)
+    panic("kmem_cache_free: %p does not belong to cache %s.\n", obj, cache->name);
+
+  if (s->free == BUFCTL_END) {
+    slab_list_del(&cache->full, s);
+    slab_list_add(&cache->partial, s);
+  }
+  s->bufctl[idx] = s->free;
+  s->free = idx;
+  s->inuse--;
+  cache->nr_active--;
+
+  if (s->inuse == 0) {
+    slab_list_del(&cache->partial, s);
+    // keep one empty slab around, so that alloc/free pairs do not bounce on the buddy
+    // allocator; release any other one.
+    if (cache->empty == NULL) {
+      cache->empty = s;
+    } else {
+      free_pages(s, cache->order);
+      cache->nr_slabs--;
+    }
+  }
+}
@@ -0,0 +1,37 @@
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include "util/types.h"
+
+// the maximum number of object caches in the kernel
+#define KMEM_MAX_CACHES 16
+// slabs are buddy blocks of at most 2^KMEM_MAX_SLAB_ORDER pages
+#define KMEM_MAX_SLAB_ORDER 3
+
+struct slab;
+
+//
+// a cache of equally-sized kernel objects. objects are carved out of slabs, i.e., buddy
+// blocks obtained from pmm.c, so that small objects no longer take a whole page each.
+//
+struct kmem_cache {
+  const char *name;
+  uint64 objsize;           // object size, rounded up to 8 bytes
+  int order;                // each slab is a buddy block of 2^order pages
+  int objs_per_slab;        // objects in one slab
+  void (*ctor)(void *obj);  // constructor, applied to every object of a new slab
+  struct slab *partial;     // slabs having both free and used objects
+  struct slab *full;        // slabs having no free object
+  struct slab *empty;       // at most one slab having no used object, kept for reuse
+  uint64 nr_active;         // number of objects handed out
+  uint64 nr_slabs;          // number of slabs owned by the cache
+};
+
+// create a cache of objects of "size" bytes. ctor may be NULL.
+struct kmem_cache *kmem_cache_create(const char *name, uint64 size, void (*ctor)(void *));
+// allocate an object from cache, returns NULL if out of memory
+void *kmem_cache_alloc(struct kmem_cache *cache);
+// return an object to its cache. objects must be freed in their constructed state.
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+
+#endif
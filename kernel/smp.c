@@ -0,0 +1,72 @@
+/*
+ * multi-hart support: per-hart state, and the kernel lock.
+ *
+ * the kernel runs on one hart at a time: a hart takes the kernel lock when it enters the
+ * kernel (smode_trap_handler, s_start), and releases it when it returns to user mode
+ * (switch_to), or while it idles. user processes run on all harts in parallel. the lock
+ * is an MCS queue lock: harts get the kernel in arrival order, each spinning on its own
+ * queue node.
+ */
+
+#include "smp.h"
+#include "process.h"
+#include "pmm.h"
+#include "sbi.h"
+#include "spike_interface/atomic.h"
+#include "spike_interface/spike_utils.h"
+
+cpu g_cpus[NCPU];
+
+static mcs_lock_t g_kernel_lock = MCS_LOCK_INIT;
+// the queue node of each hart, a hart waits for the kernel lock at most once at a time
+static mcs_node_t g_kernel_lock_node[NCPU];
+
+//
+// allocate the kernel (trap) stack of every hart. called by hart 0 at boot.
+//
+void smp_init(void) {
+  for (int i = 0; i < NCPU; i++) {
+    void *stack = alloc_page();
+    if (stack == 0) panic("smp_init: cannot allocate the kernel stack of hart %d.\n", i);
+    g_cpus[i].kstack = (uint64)stack + PGSIZE;
+  }
+}
+
+void kernel_lock(void) { mcs_lock(&g_kernel_lock, &g_kernel_lock_node[cpuid()]); }
+
+void kernel_unlock(void) { mcs_unlock(&g_kernel_lock, &g_kernel_lock_node[cpuid()]); }
+
+//
+// print how often the harts had to wait for the kernel lock.
+//
+void kernel_lock_report(void) {
+  sprint("kernel lock: %ld acquisitions, %ld contended\n", g_kernel_lock.acquired,
+         g_kernel_lock.contended);
+}
+
+//
+// page table entries of mm have been removed or write-protected. the other harts may
+// still hold them in their TLBs if they have run threads of mm: make them all flush
+// their TLBs before they next enter user mode (asid_get), and interrupt the harts that
+// run a thread of mm in user mode, waiting until they have trapped into the kernel.
+//
+void smp_tlb_shootdown(struct mm_struct *mm) {
+  // a single thread runs on one hart at a time, and switch_to flushes its ASID when it
+  // moves to another hart
+  if (mm->users < 2) return;
+
+  int self = cpuid();
+  for (int i = 0; i < NCPU; i++)
+    if (i != self) atomic_set(&g_cpus[i].tlb_flush_pending, 1);
+  mb();
+
+  for (int i = 0; i < NCPU; i++) {
+    cpu *c = &g_cpus[i];
+    if (i == self || !atomic_read(&c->in_user) || c->proc == NULL || c->proc->mm != mm)
+      continue;
+    sbi_send_ipi(i);
+    // the hart cannot take the kernel lock we hold, it only leaves user mode
+    while (atomic_read(&c->in_user))
+      ;
+  }
+}
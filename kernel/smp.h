@@ -0,0 +1,44 @@
+#ifndef _SMP_H_
+#define _SMP_H_
+
+#include "util/types.h"
+#include "riscv.h"
+#include "config.h"
+
+struct process;
+struct mm_struct;
+
+// per-hart state. while a hart runs in the kernel, tp holds its hart id (see cpuid).
+typedef struct cpu {
+  // process running on this hart
+  struct process *proc;
+  // top of the stack that traps from user mode run on
+  uint64 kstack;
+  // the hart has booted and schedules processes
+  int online;
+  // number of ready processes in the queue(s) of this hart
+  int nr_ready;
+  // the whole TLB of this hart is to be flushed before it next enters user mode
+  int tlb_flush_pending;
+  // the hart runs proc in user mode, or is on its way there (see smp_tlb_shootdown)
+  int in_user;
+  // end of the time slice of the running process, and the deadline the timer is set
+  // for (0 for none), see timer.c
+  uint64 tick_deadline;
+  uint64 timer_armed;
+  // process whose state the FP registers of this hart hold, see fp.c
+  struct process *fp_owner;
+} cpu;
+
+extern cpu g_cpus[NCPU];
+
+// id of the hart we are running on
+static inline int cpuid(void) { return read_tp(); }
+
+void smp_init(void);
+void kernel_lock(void);
+void kernel_unlock(void);
+void kernel_lock_report(void);
+void smp_tlb_shootdown(struct mm_struct *mm);
+
+#endif
@@ -9,8 +9,15 @@
 #include "pmm.h"
 #include "vmm.h"
 #include "sched.h"
+#include "timer.h"
+#include "workqueue.h"
+#include "fp.h"
+#include "syscall_ring.h"
+#include "elf.h"
+#include "memlayout.h"
 #include "util/functions.h"
 
+#include "spike_interface/atomic.h"
 #include "spike_interface/spike_utils.h"
 
 //
@@ -31,15 +38,13 @@ static void handle_syscall(trapframe *tf) {
 }
 
 //
-// global variable that store the recorded "ticks"
-uint64 g_ticks = 0;
-void handle_mtimer_trap() {
-  sprint("Ticks %d\n", g_ticks);
-  // TODO (lab1_3): increase g_ticks to record this "tick", and then clear the "SIP"
-  // field in sip register.
-  // hint: use write_csr to disable the SIP_SSIP bit in sip.
-  ++g_ticks;
-  write_csr(sip, read_csr(sip) & ~SIP_SSIP);
+// is va mapped in page_dir, with permissions perm? a thread of the process may have
+// faulted on the page, and had it mapped, while the current one was waiting for the
+// kernel: the faulting access then only has to run again.
+//
+static int page_is_mapped(pagetable_t page_dir, uint64 va, int perm) {
+  pte_t *pte = page_walk(page_dir, va, 0);
+  return pte && (*pte & PTE_V) && (*pte & perm) == perm;
 }
 
 //
@@ -51,39 +56,51 @@ void handle_user_page_fault(uint64 mcause, uint64 sepc, uint64 stval) {
   sprint("handle_page_fault: %lx\n", stval);
   switch (mcause) {
     case CAUSE_STORE_PAGE_FAULT:
+      // a store to a page shared copy-on-write after fork
+      if (user_vm_cow_fault(current->mm, stval) == 0) break;
+      // another thread of the process has mapped the page since the fault. this hart may
+      // still hold the translation it faulted on, which the access would hit again.
+      if (page_is_mapped(current->mm->pagetable, stval, PTE_U | PTE_W)) {
+        flush_tlb_page(stval);
+        break;
+      }
+      // first touch of a page of a demand-paged data segment
+      if (elf_demand_fault(current, stval) == 0) break;
+      // the kernel info page is read-only
+      if (ROUNDDOWN(stval, PGSIZE) == USER_KINFO_VA)
+        panic("illegal store to the kernel info page 0x%lx, pc 0x%lx.\n", stval, sepc);
+      // the stack grows below USER_STACK_TOP only: above it lies the kernel, which with
+      // KERNEL_IN_USER_PT shares its page table pages with every process
+      if (stval >= USER_STACK_TOP)
+        panic("illegal store to address 0x%lx, pc 0x%lx.\n", stval, sepc);
+
       // TODO (lab2_3): implement the operations that solve the page fault to
       // dynamically increase application stack. 
       // hint: first allocate a new physical page, and then, maps the new page to the
       // virtual address that causes the page fault.
       {
       uint64 newpage = (uint64)alloc_page();
-      user_vm_map((pagetable_t)current->pagetable, ROUNDDOWN(stval, PGSIZE), PGSIZE, newpage,
+      user_vm_map((pagetable_t)current->mm->pagetable, ROUNDDOWN(stval, PGSIZE), PGSIZE, newpage,
              prot_to_type(PROT_WRITE | PROT_READ, 1));
       }
       break;
+    case CAUSE_FETCH_PAGE_FAULT:
+    case CAUSE_LOAD_PAGE_FAULT:
+      if (page_is_mapped(current->mm->pagetable, stval,
+                         PTE_U | (mcause == CAUSE_LOAD_PAGE_FAULT ? PTE_R : PTE_X))) {
+        flush_tlb_page(stval);
+        break;
+      }
+      // first touch of a page of a demand-paged code or data segment
+      if (elf_demand_fault(current, stval) == 0) break;
+      panic("illegal access to user address 0x%lx, pc 0x%lx.\n", stval, sepc);
+      break;
     default:
       sprint("unknown page fault.\n");
       break;
   }
 }
 
-//
-// implements round-robin scheduling
-//
-void rrsched() {
-  // TODO (lab3_3): implements round-robin scheduling.
-  // hint: increase the tick_count member of current process by one, if it is bigger than
-  // TIME_SLICE_LEN (means it has consumed its time slice), change its status into READY,
-  // place it in the rear of ready queue, and finally schedule next process to run.
-  ++ current->tick_count;
-  ++ current->total_tick_count;
-  if ( current->tick_count >= TIME_SLICE_LEN ){
-    current->tick_count = 0;
-    insert_to_ready_queue(current);
-    schedule();
-  }
-}
-
 //
 // kernel/smode_trap.S will pass control to smode_trap_handler, when a trap happens
 // in S-mode.
@@ -93,10 +110,19 @@ void smode_trap_handler(void) {
   // we will consider other previous case in lab1_3 (interrupt).
   if ((read_csr(sstatus) & SSTATUS_SPP) != 0) panic("usertrap: not from user mode");
 
+  // one hart at a time in the kernel, released when returning to user mode (switch_to)
+  atomic_set(&g_cpus[cpuid()].in_user, 0);
+  kernel_lock();
+
   assert(current);
   // save user process counter.
   current->trapframe->epc = read_csr(sepc);
 
+  // take the timer back from smode_trap_vector, and charge current process for the time
+  // it has run, including the ticks that the trap vector took on its own
+  timer_fast_sync(current);
+  int preempt = sched_account();
+
   // if the cause of trap is syscall from user application
   uint64 cause = read_csr(scause);
 
@@ -105,11 +131,22 @@ void smode_trap_handler(void) {
       handle_syscall(current->trapframe);
       break;
     case CAUSE_MTIMER_S_TRAP:
-      handle_mtimer_trap();
-      rrsched();
+    case CAUSE_STIMER_S_TRAP: {
+      int tick = timer_interrupt(), yield;
+      // run the syscalls the process has queued so far, without waiting for its trap
+      ring_drain(current, &yield);
+      // keep the deferred work going while no hart is idle
+      if (tick) run_work(1);
+      if (yield) preempt = 1;
+      break;
+    }
+    case CAUSE_ILLEGAL_INSTRUCTION:
+      // the first FP instruction since the process was switched to turns the FPU on
+      if (fp_trap(current) != 0) panic("Illegal instruction!");
       break;
     case CAUSE_STORE_PAGE_FAULT:
     case CAUSE_LOAD_PAGE_FAULT:
+    case CAUSE_FETCH_PAGE_FAULT:
       // the address of missing page is stored in stval
       // call handle_user_page_fault to process page faults
       handle_user_page_fault(cause, read_csr(sepc), read_csr(stval));
@@ -121,6 +158,24 @@ void smode_trap_handler(void) {
       break;
   }
 
+  // the time slice of current process is over (or it has yielded): let the next one run
+  if (preempt) {
+    insert_to_ready_queue(current);
+    schedule();
+  }
+
   // continue the execution of current process.
   switch_to(current);
 }
+
+//
+// smode_trap_vector passes control to smode_kernel_trap when the trap comes from the
+// kernel itself, e.g. an FP instruction while sstatus.FS is Off. it has no process
+// context to be handled in.
+//
+void smode_kernel_trap(void) {
+  if ((read_csr(sstatus) & SSTATUS_SPP) == 0) panic("smode_kernel_trap: trap from user mode.\n");
+  sprint("smode_kernel_trap(): scause %p\n", read_csr(scause));
+  sprint("            sepc=%p stval=%p\n", read_csr(sepc), read_csr(stval));
+  panic("unexpected trap in the kernel.\n");
+}
@@ -2,5 +2,6 @@
 #define _STRAP_H_
 
 void smode_trap_handler(void);
+void smode_kernel_trap(void);
 
 #endif
@@ -10,22 +10,34 @@
 #include "string.h"
 #include "process.h"
 #include "util/functions.h"
+#include "util/string.h"
 #include "pmm.h"
 #include "vmm.h"
 #include "sched.h"
+#include "timer.h"
+#include "syscall_ring.h"
 #include "file.h"
 
 #include "spike_interface/spike_utils.h"
 
+// the longest path (with its NUL) that a syscall takes
+#define SYSCALL_PATH_MAX 256
+
 //
 // implement the SYS_user_print syscall
 //
 ssize_t sys_user_print(const char* buf, size_t n) {
-  //buf is an address in user space on user stack,
-  //so we have to transfer it into phisical address (kernel is running in direct mapping).
+  //buf is an address in user space on user stack, it is copied in piece by piece.
   assert( current );
-  char* pa = (char*)user_va_to_pa((pagetable_t)(current->pagetable), (void*)buf);
-  sprint(pa);
+  char out[256];
+  while (n > 0) {
+    size_t len = MIN(n, sizeof(out) - 1);
+    if (copyin(current, out, (uint64)buf, len) != 0) return -1;
+    out[len] = 0;
+    sprint("%s", out);
+    buf += len;
+    n -= len;
+  }
   return 0;
 }
 
@@ -44,21 +56,42 @@ ssize_t sys_user_exit(uint64 code) {
 // maybe, the simplest implementation of malloc in the world ...
 //
 uint64 sys_user_allocate_page() {
-  void* pa = alloc_page();
-  uint64 va = g_ufree_page;
-  g_ufree_page += PGSIZE;
-  user_vm_map((pagetable_t)current->pagetable, va, PGSIZE, (uint64)pa,
-         prot_to_type(PROT_WRITE | PROT_READ, 1));
-
-  return va;
+  return do_mmap(PGSIZE);
 }
 
 //
 // reclaim a page, indicated by "va".
 //
 uint64 sys_user_free_page(uint64 va) {
-  user_vm_unmap((pagetable_t)current->pagetable, va, PGSIZE, 1);
-  return 0;
+  return do_munmap(va, PGSIZE);
+}
+
+//
+// move the end of the heap of current process
+//
+uint64 sys_user_sbrk(int64 increment) {
+  return do_sbrk(increment);
+}
+
+//
+// map an anonymous range of length bytes
+//
+uint64 sys_user_mmap(uint64 length) {
+  return do_mmap(length);
+}
+
+//
+// unmap (part of) anonymous ranges
+//
+uint64 sys_user_munmap(uint64 va, uint64 length) {
+  return do_munmap(va, length);
+}
+
+//
+// returns the pid of current process
+//
+ssize_t sys_user_getpid() {
+  return current->pid;
 }
 
 //
@@ -82,6 +115,61 @@ ssize_t sys_user_yield() {
   return 0;
 }
 
+//
+// set the nice value of process pid (-1 for current process)
+//
+ssize_t sys_user_setpriority(int pid, int nice) {
+  return sched_setpriority(pid, nice);
+}
+
+//
+// sleep for ns nanoseconds
+//
+ssize_t sys_user_nanosleep(uint64 ns) {
+  if (ns == 0) return 0;
+  // timer_sleep does not return: the process resumes from its trapframe, with result 0
+  current->trapframe->regs.a0 = 0;
+  timer_sleep(timer_now() + (ns + NSEC_PER_TIME - 1) / NSEC_PER_TIME);
+  return 0;
+}
+
+//
+// give the process its syscall rings, returns their address
+//
+ssize_t sys_user_ring_setup() {
+  return do_ring_setup(current);
+}
+
+//
+// run the syscalls queued in the submission ring, returns how many
+//
+ssize_t sys_user_ring_enter() {
+  int yield;
+  int n = ring_drain(current, &yield);
+  if (yield) {
+    // a queued yield: give up the CPU as sys_user_yield does, returning n
+    current->trapframe->regs.a0 = n;
+    insert_to_ready_queue( current );
+    schedule();
+  }
+  return n;
+}
+
+//
+// start a thread that shares the address space of current process: it runs entry(fn,
+// arg) on the stack whose top is stack. returns its thread id.
+//
+ssize_t sys_user_clone(uint64 entry, uint64 fn, uint64 arg, uint64 stack) {
+  return do_clone(current, entry, fn, arg, stack);
+}
+
+//
+// wait for the thread tid of current process to exit
+//
+ssize_t sys_user_thread_join(int tid) {
+  return do_thread_join(tid);
+}
+
 //
 // add kerenl entry point of wait
 //
@@ -93,11 +181,14 @@ int sys_user_wait(int pid){
 // implement the SYS_user_getline syscall
 //
 ssize_t sys_user_getline(char * dst, int size) {
-  //buf is an address in user space on user stack,
-  //so we have to transfer it into phisical address (kernel is running in direct mapping).
+  //dst is an address in user space on user stack, the line is read into the kernel and
+  //copied out. a line is cut at 256 bytes.
   assert( current );
-  char* pa = (char*)user_va_to_pa((pagetable_t)(current->pagetable), (void*)dst);
-  sgetline(pa, size);
+  char line[256];
+  if (size <= 0) return -1;
+  if (size > sizeof(line)) size = sizeof(line);
+  sgetline(line, size);
+  if (copyout(current, (uint64)dst, line, strlen(line) + 1) != 0) return -1;
   return 0;
 }
 
@@ -105,16 +196,25 @@ ssize_t sys_user_getline(char * dst, int size) {
 // implement the SYS_user_exec syscall
 //
 ssize_t sys_user_exec(char * path, char ** argv) {
-  do_exec(path, argv);
+  if (do_exec(path, argv) < 0) return -1;
   return 0;
 }
 
+//
+// implement the SYS_user_spawn syscall: start the shell command argv as a new child of
+// current process. returns the pid of the child, or -1.
+//
+ssize_t sys_user_spawn(char * path, char ** argv) {
+  return do_spawn(path, argv);
+}
+
 //
 // open file
 //
 ssize_t sys_user_open(char *pathva, int flags) {
-  char* pathpa = (char*)user_va_to_pa((pagetable_t)(current->pagetable), pathva);
-  return do_open(pathpa, flags);
+  char path[SYSCALL_PATH_MAX];
+  if (copyinstr(current, path, (uint64)pathva, sizeof(path)) < 0) return -1;
+  return do_open(path, flags);
 }
 
 //
@@ -124,7 +224,8 @@ ssize_t sys_user_read(int fd, char *bufva, uint64 count) {
   int i = 0;
   while (i < count) { // count can be greater than page size
     uint64 addr = (uint64)bufva + i;
-    uint64 pa = lookup_pa((pagetable_t)current->pagetable, addr);
+    uint64 pa = (uint64)user_va_access(current, ROUNDDOWN(addr, PGSIZE), 1);
+    if (pa == 0) return -1;
     uint64 off = addr - ROUNDDOWN(addr, PGSIZE);
     uint64 len = count - i < PGSIZE - off ? count - i : PGSIZE - off;
     uint64 r = do_read(fd, (char *)pa + off, len);
@@ -140,7 +241,8 @@ ssize_t sys_user_write(int fd, char *bufva, uint64 count) {
   int i = 0;
   while (i < count) { // count can be greater than page size
     uint64 addr = (uint64)bufva + i;
-    uint64 pa = lookup_pa((pagetable_t)current->pagetable, addr);
+    uint64 pa = (uint64)user_va_access(current, ROUNDDOWN(addr, PGSIZE), 0);
+    if (pa == 0) return -1;
     uint64 off = addr - ROUNDDOWN(addr, PGSIZE);
     uint64 len = count - i < PGSIZE - off ? count - i : PGSIZE - off;
     uint64 r = do_write(fd, (char *)pa + off, len);
@@ -168,43 +270,148 @@ ssize_t sys_user_getinfo() {
   return do_getinfo();
 }
 
+static ssize_t sys_user_syscall_stats(syscall_stat* buf, int n);
+
+// a syscall may not return: it switches to another process, and the result is left in
+// the trapframe (or the syscall is restarted) instead
+#define SYSCALL_NORETURN 1
+// a syscall that may be queued in the syscall rings (see syscall_ring.c)
+#define SYSCALL_RING 2
+
+typedef long (*syscall_fn)(long a1, long a2, long a3, long a4, long a5, long a6, long a7);
+
+typedef struct syscall_desc {
+  const char* name;
+  syscall_fn fn;
+  int flags;
+} syscall_desc;
+
+// sys_<nr>: the entry of syscall nr in the table below, which passes the syscall arguments
+// a1 ... a7 to its handler as the types that the handler takes
+#define SYSCALL_THUNK(nr, call)                                                            \
+  static long sys_##nr(long a1, long a2, long a3, long a4, long a5, long a6, long a7) {     \
+    return call;                                                                           \
+  }
+
+SYSCALL_THUNK(print, sys_user_print((const char*)a1, (size_t)a2))
+SYSCALL_THUNK(exit, sys_user_exit((uint64)a1))
+SYSCALL_THUNK(allocate_page, sys_user_allocate_page())
+SYSCALL_THUNK(free_page, sys_user_free_page((uint64)a1))
+SYSCALL_THUNK(fork, sys_user_fork())
+SYSCALL_THUNK(yield, sys_user_yield())
+SYSCALL_THUNK(sbrk, sys_user_sbrk((int64)a1))
+SYSCALL_THUNK(mmap, sys_user_mmap((uint64)a1))
+SYSCALL_THUNK(munmap, sys_user_munmap((uint64)a1, (uint64)a2))
+SYSCALL_THUNK(getpid, sys_user_getpid())
+SYSCALL_THUNK(setpriority, sys_user_setpriority((int)a1, (int)a2))
+SYSCALL_THUNK(nanosleep, sys_user_nanosleep((uint64)a1))
+SYSCALL_THUNK(ring_setup, sys_user_ring_setup())
+SYSCALL_THUNK(ring_enter, sys_user_ring_enter())
+SYSCALL_THUNK(wait, sys_user_wait((int)a1))
+SYSCALL_THUNK(getline, sys_user_getline((char*)a1, (int)a2))
+SYSCALL_THUNK(exec, sys_user_exec((char*)a1, (char**)a2))
+SYSCALL_THUNK(open, sys_user_open((char*)a1, (int)a2))
+SYSCALL_THUNK(read, sys_user_read((int)a1, (char*)a2, (uint64)a3))
+SYSCALL_THUNK(write, sys_user_write((int)a1, (char*)a2, (uint64)a3))
+SYSCALL_THUNK(close, sys_user_close((int)a1))
+SYSCALL_THUNK(getinfo, sys_user_getinfo())
+SYSCALL_THUNK(syscall_stats, sys_user_syscall_stats((syscall_stat*)a1, (int)a2))
+SYSCALL_THUNK(clone, sys_user_clone((uint64)a1, (uint64)a2, (uint64)a3, (uint64)a4))
+SYSCALL_THUNK(thread_join, sys_user_thread_join((int)a1))
+SYSCALL_THUNK(spawn, sys_user_spawn((char*)a1, (char**)a2))
+
+#define SYSCALL(nr, fl) [SYS_user_##nr - SYS_user_base] = { #nr, sys_##nr, (fl) }
+
+// the syscalls, indexed by their number less SYS_user_base
+static const syscall_desc syscall_table[] = {
+  SYSCALL(print, SYSCALL_RING),
+  SYSCALL(exit, SYSCALL_NORETURN),
+  SYSCALL(allocate_page, 0),
+  SYSCALL(free_page, 0),
+  SYSCALL(fork, 0),
+  SYSCALL(yield, SYSCALL_NORETURN),
+  SYSCALL(sbrk, 0),
+  SYSCALL(mmap, 0),
+  SYSCALL(munmap, 0),
+  SYSCALL(getpid, SYSCALL_RING),
+  SYSCALL(setpriority, 0),
+  SYSCALL(nanosleep, SYSCALL_NORETURN),
+  SYSCALL(ring_setup, 0),
+  SYSCALL(ring_enter, SYSCALL_NORETURN),
+  SYSCALL(wait, SYSCALL_NORETURN),
+  SYSCALL(getline, 0),
+  SYSCALL(exec, 0),
+  SYSCALL(open, SYSCALL_RING),
+  SYSCALL(read, SYSCALL_RING),
+  SYSCALL(write, SYSCALL_RING),
+  SYSCALL(close, SYSCALL_RING),
+  SYSCALL(getinfo, 0),
+  SYSCALL(syscall_stats, 0),
+  SYSCALL(clone, 0),
+  SYSCALL(thread_join, SYSCALL_NORETURN),
+  SYSCALL(spawn, 0),
+};
+
+#define NR_SYSCALLS ARRAY_SIZE(syscall_table)
+
+// calls and latencies of each syscall, kept under the kernel lock
+static syscall_stat syscall_stats[NR_SYSCALLS];
+
+static const syscall_desc* syscall_lookup(long a0) {
+  uint64 nr = a0 - SYS_user_base;
+  if (nr >= NR_SYSCALLS || syscall_table[nr].fn == NULL) return NULL;
+  return &syscall_table[nr];
+}
+
+//
+// whether syscall a0 may be queued in the syscall rings.
+//
+int syscall_ring_allowed(long a0) {
+  const syscall_desc* d = syscall_lookup(a0);
+  return d && (d->flags & SYSCALL_RING);
+}
+
+//
+// copy the syscall statistics to the n entries of the user buffer buf, returns how many
+// were copied.
+//
+static ssize_t sys_user_syscall_stats(syscall_stat* buf, int n) {
+  if (n < 0) return -1;
+  if (n > NR_SYSCALLS) n = NR_SYSCALLS;
+
+  for (int i = 0; i < n; i++) {
+    // the record goes out with the name of the syscall
+    syscall_stat st = syscall_stats[i];
+    safestrcpy(st.name, syscall_table[i].name ? syscall_table[i].name : "", sizeof(st.name));
+    if (copyout(current, (uint64)&buf[i], &st, sizeof(st)) != 0) return -1;
+  }
+  return n;
+}
+
 //
 // [a0]: the syscall number; [a1] ... [a7]: arguments to the syscalls.
-// returns the code of success, (e.g., 0 means success, fail for otherwise)
+// returns the code of success, (e.g., 0 means success, fail for otherwise), -1 for an
+// unknown syscall.
 //
 long do_syscall(long a0, long a1, long a2, long a3, long a4, long a5, long a6, long a7) {
-  switch (a0) {
-    case SYS_user_print:
-      return sys_user_print((const char*)a1, a2);
-    case SYS_user_exit:
-      return sys_user_exit(a1);
-    case SYS_user_allocate_page:
-      return sys_user_allocate_page();
-    case SYS_user_free_page:
-      return sys_user_free_page(a1);
-    case SYS_user_fork:
-      return sys_user_fork();
-    case SYS_user_yield:
-      return sys_user_yield();
-    case SYS_user_wait:
-      return sys_user_wait(a1);
-    case SYS_user_getline:
-      return sys_user_getline((char *)a1, (int)a2);
-    case SYS_user_exec:
-      return sys_user_exec((char *)a1, (char **)a2);
-    case SYS_user_open:
-      return sys_user_open((char *)a1, a2);
-    // case SYS_user_create:
-    //   return sys_user_create((char *)a1);
-    case SYS_user_read:
-      return sys_user_read(a1, (char *)a2, a3);
-    case SYS_user_write:
-      return sys_user_write(a1, (char *)a2, a3);
-    case SYS_user_close:
-      return sys_user_close(a1);
-    case SYS_user_getinfo:
-      return sys_user_getinfo();
-    default:
-      panic("Unknown syscall %ld \n", a0);
+  const syscall_desc* d = syscall_lookup(a0);
+  if (d == NULL) {
+    sprint("unknown syscall %ld\n", a0);
+    return -1;
   }
+
+  syscall_stat* st = &syscall_stats[d - syscall_table];
+  st->calls++;
+  uint64 start = read_csr(cycle);
+
+  long ret = d->fn(a1, a2, a3, a4, a5, a6, a7);
+
+  // a SYSCALL_NORETURN one gets here only when it did not switch processes
+  uint64 cycles = read_csr(cycle) - start;
+  int bucket = 0;
+  while (bucket < SYSCALL_HIST_BUCKETS - 1 && (cycles >> (bucket + 1)) != 0) bucket++;
+  st->returns++;
+  st->cycles += cycles;
+  st->hist[bucket]++;
+  return ret;
 }
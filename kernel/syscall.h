@@ -4,6 +4,8 @@
 #ifndef _SYSCALL_H_
 #define _SYSCALL_H_
 
+#include "util/types.h"
+
 // syscalls of PKE OS kernel. append below if adding new syscalls.
 #define SYS_user_base 64
 #define SYS_user_print (SYS_user_base + 0)
@@ -12,6 +14,14 @@
 #define SYS_user_free_page (SYS_user_base + 3)
 #define SYS_user_fork (SYS_user_base + 4)
 #define SYS_user_yield (SYS_user_base + 5)
+#define SYS_user_sbrk (SYS_user_base + 6)
+#define SYS_user_mmap (SYS_user_base + 7)
+#define SYS_user_munmap (SYS_user_base + 8)
+#define SYS_user_getpid (SYS_user_base + 9)
+#define SYS_user_setpriority (SYS_user_base + 10)
+#define SYS_user_nanosleep (SYS_user_base + 11)
+#define SYS_user_ring_setup (SYS_user_base + 12)
+#define SYS_user_ring_enter (SYS_user_base + 13)
 
 #define SYS_user_wait (SYS_user_base + 14)
 #define SYS_user_getline (SYS_user_base + 15)
@@ -24,7 +34,28 @@
 #define SYS_user_close (SYS_user_base + 20)
 
 #define SYS_user_getinfo (SYS_user_base + 21)
+#define SYS_user_syscall_stats (SYS_user_base + 22)
+// threads
+#define SYS_user_clone (SYS_user_base + 23)
+#define SYS_user_thread_join (SYS_user_base + 24)
+// fork and exec in one go
+#define SYS_user_spawn (SYS_user_base + 25)
+
+// log2 latency buckets: bucket i counts the calls that took [2^i, 2^(i+1)) cycles (the
+// last one, anything longer)
+#define SYSCALL_HIST_BUCKETS 32
+
+// what the kernel has recorded about one syscall, see SYS_user_syscall_stats
+typedef struct syscall_stat {
+  char name[16];
+  uint64 calls;
+  // the calls that returned, and the cycles they took in all
+  uint64 returns;
+  uint64 cycles;
+  uint64 hist[SYSCALL_HIST_BUCKETS];
+} syscall_stat;
 
 long do_syscall(long a0, long a1, long a2, long a3, long a4, long a5, long a6, long a7);
+int syscall_ring_allowed(long a0);
 
 #endif
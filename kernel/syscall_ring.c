@@ -0,0 +1,75 @@
+/*
+ * syscall rings, see syscall_ring.h.
+ */
+
+#include "syscall_ring.h"
+#include "syscall.h"
+#include "process.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "memlayout.h"
+#include "util/string.h"
+#include "spike_interface/spike_utils.h"
+
+_Static_assert(sizeof(syscall_ring) <= PGSIZE, "the syscall rings overflow their page");
+
+//
+// give process p its rings, if it has none yet. returns their user address, 0 if out of
+// memory.
+//
+uint64 do_ring_setup(process* p) {
+  if (p->mm->ring) return USER_RING_VA;
+
+  syscall_ring* ring = (syscall_ring*)alloc_page();
+  if (ring == NULL) return 0;
+  mapped_region* r = new_mapped_region(p);
+  if (r == NULL) {
+    free_page(ring);
+    return 0;
+  }
+
+  memset(ring, 0, PGSIZE);
+  user_vm_map(p->mm->pagetable, USER_RING_VA, PGSIZE, (uint64)ring,
+              prot_to_type(PROT_READ | PROT_WRITE, 1));
+  r->va = USER_RING_VA;
+  r->npages = 1;
+  r->seg_type = RING_SEGMENT;
+  p->mm->ring = ring;
+  return USER_RING_VA;
+}
+
+//
+// run the syscalls queued by process p, which must be current, while there is room for
+// their results. a queued yield ends the batch, and sets *yield for the caller to carry
+// it out. returns the number of syscalls run.
+//
+int ring_drain(process* p, int* yield) {
+  syscall_ring* ring = p->mm->ring;
+  int n = 0;
+  *yield = 0;
+  if (ring == NULL) return 0;
+
+  __sync_synchronize();
+  while (ring->sq_head != ring->sq_tail && !*yield) {
+    if (ring->cq_tail - ring->cq_head >= RING_ENTRIES) break;  // no room for the result
+
+    ring_sqe sqe = ring->sq[ring->sq_head % RING_ENTRIES];
+    ring->sq_head++;
+
+    int64 result = -1;
+    if (sqe.opcode == SYS_user_yield) {
+      result = 0;
+      *yield = 1;
+    } else if (syscall_ring_allowed(sqe.opcode)) {
+      result = do_syscall(sqe.opcode, sqe.args[0], sqe.args[1], sqe.args[2], 0, 0, 0, 0);
+    }
+
+    ring_cqe* cqe = &ring->cq[ring->cq_tail % RING_ENTRIES];
+    cqe->result = result;
+    cqe->user_data = sqe.user_data;
+    __sync_synchronize();
+    ring->cq_tail++;
+    n++;
+  }
+  return n;
+}
@@ -0,0 +1,44 @@
+/*
+ * syscall rings: a page shared by a process and the kernel, mapped at USER_RING_VA once
+ * the process asks for it (SYS_user_ring_setup). the process queues syscalls in the
+ * submission ring, and has the kernel run them in a batch with one SYS_user_ring_enter
+ * trap (or at its next timer interrupt). their results come back in the completion ring.
+ */
+#ifndef _SYSCALL_RING_H_
+#define _SYSCALL_RING_H_
+
+#include "util/types.h"
+
+// entries of each ring, a power of two
+#define RING_ENTRIES 64
+
+// a queued syscall: its number (yield, or one marked SYSCALL_RING in syscall.c), up to
+// three arguments, and a tag passed back with the result
+typedef struct ring_sqe {
+  uint64 opcode;
+  uint64 args[3];
+  uint64 user_data;
+} ring_sqe;
+
+// the result of a syscall, -1 for one that cannot be queued
+typedef struct ring_cqe {
+  int64 result;
+  uint64 user_data;
+} ring_cqe;
+
+// the head of a ring is advanced by its consumer, the tail by its producer. both run
+// freely, an entry lives at index % RING_ENTRIES
+typedef struct syscall_ring {
+  uint32 sq_head;  // kernel
+  uint32 sq_tail;  // process
+  uint32 cq_head;  // process
+  uint32 cq_tail;  // kernel
+  ring_sqe sq[RING_ENTRIES];
+  ring_cqe cq[RING_ENTRIES];
+} syscall_ring;
+
+struct process;
+uint64 do_ring_setup(struct process* p);
+int ring_drain(struct process* p, int* yield);
+
+#endif
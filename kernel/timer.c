@@ -0,0 +1,191 @@
+/*
+ * tickless timer. instead of taking a tick every TIMER_INTERVAL, each hart programs its
+ * timer (through M-mode, see sbi.h) for its next deadline only, which is the earlier of
+ *  - the end of the time slice of the running process, while another process is ready
+ *    to take over on this hart, or the process has syscall rings to drain: a process
+ *    running alone takes no timer interrupts otherwise.
+ *  - the earliest wakeup of the processes sleeping on this hart, kept in a min-heap.
+ *
+ * run time is not counted in interrupts but read from the time counter: a process is
+ * charged for the time since it was switched to, or last charged, at each of its traps
+ * (timer_account), and the policy is given the whole ticks that makes.
+ *
+ * the timer raises a supervisor timer interrupt, while another hart wakes this one with
+ * a supervisor software interrupt (IPI). a timer interrupt that is only a tick, which the
+ * policy says does not end the time slice, is taken by smode_trap_vector alone
+ * (TIMER_FAST_PATH): it sets the next tick deadline and goes back to user mode, and the
+ * time it let pass is charged at the next trap of the process.
+ */
+
+#include "timer.h"
+#include "sched.h"
+#include "pmm.h"
+#include "sbi.h"
+#include "config.h"
+#include "spike_interface/spike_utils.h"
+
+uint64 g_ticks = 0;
+static uint64 g_boot_time = 0;
+
+// min-heap of the processes sleeping on each hart, keyed by process.sleep_deadline
+static process** sleep_heap[NCPU];
+static int sleep_heap_size[NCPU];
+
+void timer_init(int nproc) {
+  g_boot_time = timer_now();
+  for (int c = 0; c < NCPU; c++) {
+    sleep_heap[c] = (process**)alloc_pages(get_order(sizeof(process*) * nproc));
+    if (sleep_heap[c] == NULL) panic("timer_init: cannot allocate the sleep queue.\n");
+  }
+}
+
+//
+// block the current process until time deadline. like sleep_on, never returns.
+//
+void timer_sleep(uint64 deadline) {
+  int id = cpuid();
+  process** heap = sleep_heap[id];
+
+  current->status = BLOCKED;
+  current->sleep_deadline = deadline;
+
+  int i = sleep_heap_size[id]++;
+  while (i > 0 && heap[(i - 1) / 2]->sleep_deadline > deadline) {
+    heap[i] = heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  heap[i] = current;
+
+  schedule();
+}
+
+//
+// take the process with the earliest deadline out of the sleep heap of hart id.
+//
+static process* sleep_heap_pop(int id) {
+  process** heap = sleep_heap[id];
+  process* top = heap[0];
+  process* last = heap[--sleep_heap_size[id]];
+
+  int i = 0;
+  for (;;) {
+    int c = 2 * i + 1;
+    if (c >= sleep_heap_size[id]) break;
+    if (c + 1 < sleep_heap_size[id] && heap[c + 1]->sleep_deadline < heap[c]->sleep_deadline)
+      c++;
+    if (heap[c]->sleep_deadline >= last->sleep_deadline) break;
+    heap[i] = heap[c];
+    i = c;
+  }
+  heap[i] = last;
+  return top;
+}
+
+//
+// handle the timer or software interrupt of this hart: wake up the sleepers that are
+// due. returns nonzero if the time slice of the running process is over.
+//
+int timer_interrupt(void) {
+  int id = cpuid();
+  cpu* c = &g_cpus[id];
+  uint64 now = timer_now();
+
+  write_csr(sip, read_csr(sip) & ~SIP_SSIP);
+  // a timer that fired stays pending until it is set again, make timer_program set it
+  if (read_csr(sip) & SIP_STIP) c->timer_armed = (uint64)-1;
+  g_ticks = (now - g_boot_time) / TIMER_INTERVAL;
+
+  while (sleep_heap_size[id] > 0 && sleep_heap[id][0]->sleep_deadline <= now)
+    insert_to_ready_queue(sleep_heap_pop(id));
+
+#if PMM_LAZY_INIT && PMM_DEFERRED_INIT
+  pmm_deferred_init();
+#endif
+
+  if (c->tick_deadline && now >= c->tick_deadline) {
+    c->tick_deadline = 0;
+    return 1;
+  }
+  return 0;
+}
+
+//
+// program the timer of this hart for its next deadline, if it has one. called on the way
+// out of the kernel, to user mode (switch_to) or to idle.
+//
+void timer_program(void) {
+  int id = cpuid();
+  cpu* c = &g_cpus[id];
+
+  if (c->proc && (c->nr_ready > 0 || c->proc->mm->ring)) {
+    if (!c->tick_deadline) c->tick_deadline = timer_now() + TIMER_INTERVAL;
+  } else {
+    c->tick_deadline = 0;
+  }
+
+  uint64 deadline = c->tick_deadline;
+  if (sleep_heap_size[id] > 0 && (!deadline || sleep_heap[id][0]->sleep_deadline < deadline))
+    deadline = sleep_heap[id][0]->sleep_deadline;
+
+  if (deadline == c->timer_armed) return;
+  c->timer_armed = deadline;
+  sbi_set_timer(deadline ? deadline : (uint64)-1);
+}
+
+//
+// charge process p, running on this hart, for the time since it was switched to or last
+// charged. returns the number of whole ticks (TIMER_INTERVALs) this adds to its run time.
+//
+int timer_account(process* p) {
+  uint64 now = timer_now();
+  g_ticks = (now - g_boot_time) / TIMER_INTERVAL;
+
+  p->run_time += now - p->run_start;
+  p->run_start = now;
+  int ticks = p->run_time / TIMER_INTERVAL - p->total_tick_count;
+  p->total_tick_count += ticks;
+  return ticks;
+}
+
+//
+// the whole ticks process p has run, with the time it has been running on its hart since
+// it was last charged (it may not trap for long).
+//
+int timer_run_ticks(process* p) {
+  uint64 t = p->run_time;
+  if (p->status == RUNNING) t += timer_now() - p->run_start;
+  return t / TIMER_INTERVAL;
+}
+
+//
+// prepare the timer fast path of smode_trap_vector for process p, about to return to
+// user mode on this hart. called after timer_program.
+//
+void timer_fast_setup(process* p) {
+  int id = cpuid();
+  cpu* c = &g_cpus[id];
+  trapframe* tf = p->trapframe;
+
+  tf->fast_ticks = 0;
+  tf->fast_taken = 0;
+  // only a tick may take the fast path, and the syscall ring of p is drained at ticks
+  if (!TIMER_FAST_PATH || p->mm->ring || !c->tick_deadline || c->timer_armed != c->tick_deadline)
+    return;
+
+  tf->fast_ticks = sched_ticks_left(p);
+  tf->fast_limit = sleep_heap_size[id] > 0 ? sleep_heap[id][0]->sleep_deadline : (uint64)-1;
+}
+
+//
+// on a trap of process p, take back the timer of this hart from the fast path. the time
+// of the ticks it took is charged to p by timer_account.
+//
+void timer_fast_sync(process* p) {
+  trapframe* tf = p->trapframe;
+  if (tf->fast_taken == 0) return;
+
+  cpu* c = &g_cpus[cpuid()];
+  c->tick_deadline = c->timer_armed = tf->fast_deadline;
+  tf->fast_ticks = 0;
+  tf->fast_taken = 0;
+}
@@ -0,0 +1,24 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include "process.h"
+
+// nanoseconds per unit of the time (mtime) counter
+#define NSEC_PER_TIME (1000000000 / TIMEBASE_FREQ)
+
+// TIMER_INTERVALs elapsed since boot
+extern uint64 g_ticks;
+
+// current time, in units of the mtime counter
+static inline uint64 timer_now(void) { return read_csr(time); }
+
+void timer_init(int nproc);
+void timer_sleep(uint64 deadline);
+int timer_interrupt(void);
+void timer_program(void);
+int timer_account(process* p);
+int timer_run_ticks(process* p);
+void timer_fast_setup(process* p);
+void timer_fast_sync(process* p);
+
+#endif
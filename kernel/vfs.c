@@ -1,14 +1,39 @@
 #include "vfs.h"
-#include "pmm.h"
+#include "slab.h"
 #include "util/string.h"
 #include "spike_interface/spike_utils.h"
 
 
+// object caches of the vfs layer
+static struct kmem_cache * fs_cachep;
+static struct kmem_cache * inode_cachep;
+
+//
+// constructor of fs and inode objects: they start zero-filled
+//
+static void fs_ctor(void * obj){
+  memset(obj, 0, sizeof(struct fs));
+}
+
+static void inode_ctor(void * obj){
+  memset(obj, 0, sizeof(struct inode));
+}
+
+//
+// vfs_init: create the object caches used by the vfs layer, called by fs_init
+//
+void vfs_init(void){
+  fs_cachep    = kmem_cache_create("fs", sizeof(struct fs), fs_ctor);
+  inode_cachep = kmem_cache_create("inode", sizeof(struct inode), inode_ctor);
+}
+
 //
 // alloc a file system abstract
 //
 struct fs * alloc_fs(int fs_type){
-  struct fs * fs = (struct fs *)alloc_page();
+  struct fs * fs = (struct fs *)kmem_cache_alloc(fs_cachep);
+  if ( fs == NULL )
+    panic("alloc_fs: out of memory!\n");
   fs->fs_type = fs_type;
   return fs;
 }
@@ -17,7 +42,9 @@ struct fs * alloc_fs(int fs_type){
 // alloc an inode
 //
 struct inode * alloc_inode(int in_type){
-  struct inode * node = (struct inode *)alloc_page();
+  struct inode * node = (struct inode *)kmem_cache_alloc(inode_cachep);
+  if ( node == NULL )
+    panic("alloc_inode: out of memory!\n");
   node->in_type = in_type;
   return node;
 }
@@ -130,7 +130,7 @@ struct vfs_dev_t * vdev_list[MAX_DEV];  // device info list in vfs layer
  * The VFS layer translates operations on abstract on-disk files or
  * pathnames to operations on specific files on specific filesystems.
  */
-// void vfs_init(void);
+void vfs_init(void);
 // void vfs_cleanup(void);
 
 struct fs * alloc_fs(int fs_type);
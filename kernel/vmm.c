@@ -7,29 +7,50 @@
 #include "pmm.h"
 #include "util/types.h"
 #include "memlayout.h"
+#include "smp.h"
+#include "elf.h"
 #include "util/string.h"
 #include "spike_interface/spike_utils.h"
 #include "util/functions.h"
 
 /* --- utility functions for virtual address mapping --- */
+static pte_t *walk(pagetable_t page_dir, uint64 va, int level, int alloc, int *leaf_level);
+
 //
 // establish mapping of virtual address [va, va+size] to phyiscal address [pa, pa+size]
-// with the permission of "perm".
+// with the permission of "perm", using leaf pages of up to level "max_level" (see
+// PGSIZE_LEVEL) wherever va, pa and the remaining size are aligned to them.
 //
-int map_pages(pagetable_t page_dir, uint64 va, uint64 size, uint64 pa, int perm) {
+static int map_range(pagetable_t page_dir, uint64 va, uint64 size, uint64 pa, int perm,
+                     int max_level) {
   uint64 first, last;
   pte_t *pte;
 
-  for (first = ROUNDDOWN(va, PGSIZE), last = ROUNDDOWN(va + size - 1, PGSIZE);
-      first <= last; first += PGSIZE, pa += PGSIZE) {
-    if ((pte = page_walk(page_dir, first, 1)) == 0) return -1;
+  for (first = ROUNDDOWN(va, PGSIZE), last = ROUNDDOWN(va + size - 1, PGSIZE); first <= last;) {
+    int level = max_level;
+    while (level > 0 && (((first | pa) & (PGSIZE_LEVEL(level) - 1)) != 0 ||
+                         first + PGSIZE_LEVEL(level) - 1 > last + PGSIZE - 1))
+      level--;
+
+    if ((pte = walk(page_dir, first, level, 1, 0)) == 0) return -1;
     if (*pte & PTE_V)
       panic("map_pages fails on mapping va (0x%lx) to pa (0x%lx)", first, pa);
     *pte = PA2PTE(pa) | perm | PTE_V;
+
+    first += PGSIZE_LEVEL(level);
+    pa += PGSIZE_LEVEL(level);
   }
   return 0;
 }
 
+//
+// establish mapping of virtual address [va, va+size] to phyiscal address [pa, pa+size]
+// with the permission of "perm", using 4KB pages.
+//
+int map_pages(pagetable_t page_dir, uint64 va, uint64 size, uint64 pa, int perm) {
+  return map_range(page_dir, va, size, pa, perm, 0);
+}
+
 //
 // convert permission code to permission types of PTE
 //
@@ -44,10 +65,12 @@ uint64 prot_to_type(int prot, int user) {
 }
 
 //
-// traverse the page table (starting from page_dir) to find the corresponding pte of va.
-// returns: PTE (page table entry) pointing to va.
+// traverse the page table (starting from page_dir) to find the pte of va at "level"
+// (0 for a 4KB page, 1 for a 2MB megapage, 2 for a 1GB gigapage). if a leaf is met
+// at a higher level, i.e., va is mapped by a larger page, that leaf is returned instead.
+// the level of the returned pte is stored in *leaf_level if it is not NULL.
 //
-pte_t *page_walk(pagetable_t page_dir, uint64 va, int alloc) {
+static pte_t *walk(pagetable_t page_dir, uint64 va, int level, int alloc, int *leaf_level) {
   if (va >= MAXVA) panic("page_walk");
 
   // starting from the page directory
@@ -56,14 +79,19 @@ pte_t *page_walk(pagetable_t page_dir, uint64 va, int alloc) {
   // traverse from page directory to page table.
   // as we use risc-v sv39 paging scheme, there will be 3 layers: page dir,
   // page medium dir, and page table.
-  for (int level = 2; level > 0; level--) {
+  for (int l = 2; l > level; l--) {
     // macro "PX" gets the PTE index in page table of current level
     // "pte" points to the entry of current level
-    pte_t *pte = pt + PX(level, va);
+    pte_t *pte = pt + PX(l, va);
 
     // now, we need to know if above pte is valid (established mapping to phyiscal page)
     // or not.
     if (*pte & PTE_V) {  //PTE valid
+      // a megapage or gigapage maps va
+      if (PTE_LEAF(*pte)) {
+        if (leaf_level) *leaf_level = l;
+        return pte;
+      }
       // phisical address of pagetable of next level
       pt = (pagetable_t)PTE2PA(*pte);
     } else { //PTE invalid (not exist).
@@ -78,27 +106,47 @@ pte_t *page_walk(pagetable_t page_dir, uint64 va, int alloc) {
     }
   }
 
-  // return a PTE which contains phisical address of a page
-  return pt + PX(0, va);
+  if (leaf_level) *leaf_level = level;
+  return pt + PX(level, va);
+}
+
+//
+// traverse the page table (starting from page_dir) to find the corresponding pte of va.
+// returns: PTE (page table entry) pointing to va, which may be the pte of a megapage or
+// gigapage mapping va.
+//
+pte_t *page_walk(pagetable_t page_dir, uint64 va, int alloc) {
+  return walk(page_dir, va, 0, alloc, 0);
 }
 
 //
 // look up a virtual page address, return the physical page address or 0 if not mapped.
+// the leaf pte that maps it is stored in *ptep if ptep is not NULL.
 //
-uint64 lookup_pa(pagetable_t pagetable, uint64 va) {
+static uint64 lookup_leaf(pagetable_t pagetable, uint64 va, pte_t **ptep) {
   pte_t *pte;
   uint64 pa;
+  int level;
 
   if (va >= MAXVA) return 0;
 
-  pte = page_walk(pagetable, va, 0);
+  pte = walk(pagetable, va, 0, 0, &level);
   if (pte == 0 || (*pte & PTE_V) == 0 || ((*pte & PTE_R) == 0 && (*pte & PTE_W) == 0))
     return 0;
-  pa = PTE2PA(*pte);
+  // for a megapage or gigapage, add the offset of va's 4KB page within it
+  pa = PTE2PA(*pte) + (ROUNDDOWN(va, PGSIZE) & (PGSIZE_LEVEL(level) - 1));
 
+  if (ptep) *ptep = pte;
   return pa;
 }
 
+//
+// look up a virtual page address, return the physical page address or 0 if not mapped.
+//
+uint64 lookup_pa(pagetable_t pagetable, uint64 va) {
+  return lookup_leaf(pagetable, va, 0);
+}
+
 /* --- kernel page table part --- */
 // _etext is defined in kernel.lds, it points to the address after text and rodata segments.
 extern char _etext[];
@@ -110,7 +158,9 @@ pagetable_t g_kernel_pagetable;
 // maps virtual address [va, va+sz] to [pa, pa+sz] (for kernel).
 //
 void kern_vm_map(pagetable_t page_dir, uint64 va, uint64 pa, uint64 sz, int perm) {
-  if (map_pages(page_dir, va, sz, pa, perm) != 0) panic("kern_vm_map");
+  // the kernel direct map uses megapages (and gigapages) wherever alignment allows, to
+  // keep the kernel page table small and to take fewer TLB misses.
+  if (map_range(page_dir, va, sz, pa, perm, KERN_MAP_MAX_LEVEL) != 0) panic("kern_vm_map");
 }
 
 //
@@ -125,8 +175,12 @@ void kern_vm_init(void) {
 
   // map virtual address [KERN_BASE, _etext] to physical address [DRAM_BASE, DRAM_BASE+(_etext - KERN_BASE)],
   // to maintain (direct) text section kernel address mapping.
+  // with KERNEL_IN_USER_PT, the kernel mappings are also in every user page table, they
+  // are global so that one TLB entry serves all address spaces.
+  int global = KERNEL_IN_USER_PT ? PTE_G : 0;
+
   kern_vm_map(t_page_dir, KERN_BASE, DRAM_BASE, (uint64)_etext - KERN_BASE,
-         prot_to_type(PROT_READ | PROT_EXEC, 0));
+         prot_to_type(PROT_READ | PROT_EXEC, 0) | global);
 
   sprint("KERN_BASE 0x%lx\n", lookup_pa(t_page_dir, KERN_BASE));
 
@@ -134,15 +188,35 @@ void kern_vm_init(void) {
   // this is important when kernel needs to access the memory content of user's app
   // without copying pages between kernel and user spaces.
   kern_vm_map(t_page_dir, (uint64)_etext, (uint64)_etext, PHYS_TOP - (uint64)_etext,
-         prot_to_type(PROT_READ | PROT_WRITE, 0));
+         prot_to_type(PROT_READ | PROT_WRITE, 0) | global);
 
   sprint("physical address of _etext is: 0x%lx\n", lookup_pa(t_page_dir, (uint64)_etext));
 
   g_kernel_pagetable = t_page_dir;
 }
 
+//
+// switch this hart to the kernel page table, if it is not on it. with KERNEL_IN_USER_PT
+// the kernel runs on the page table of the process it serves, and has to leave it
+// before the page table may be freed.
+//
+void kern_vm_switch(void) {
+  uint64 satp = MAKE_SATP(g_kernel_pagetable);
+  if (read_csr(satp) != satp) write_csr(satp, satp);
+}
+
 /* --- user page table part --- */
 
+//
+// share the kernel mappings with the user page table page_dir (KERNEL_IN_USER_PT): its
+// top-level entries for [KERN_BASE, PHYS_TOP) point to the page table pages of the
+// kernel, so that later kernel mappings show up in every process.
+//
+void user_vm_map_kernel(pagetable_t page_dir) {
+  for (uint64 va = KERN_BASE; va < PHYS_TOP; va += 1UL << PXSHIFT(2))
+    page_dir[PX(2, va)] = g_kernel_pagetable[PX(2, va)];
+}
+
 //
 // convert and return the corresponding physical address of a virtual address (va) of
 // application.
@@ -157,25 +231,36 @@ void *user_va_to_pa(pagetable_t page_dir, void *va) {
   // (va - va & (1<<PGSHIFT -1)) means computing the offset of "va" in its page.
   // Also, it is possible that "va" is not mapped at all. in such case, we can find
   // invalid PTE, and should return NULL.
-  uint64 page_addr = lookup_pa(page_dir, (uint64)va);
+  // with KERNEL_IN_USER_PT the kernel is mapped in page_dir as well: only user pages
+  // below the user stack top are user memory that a syscall may touch.
+  pte_t *pte;
+  if ((uint64)va >= USER_STACK_TOP) return 0;
+  uint64 page_addr = lookup_leaf(page_dir, (uint64)va, &pte);
 
-  if (!page_addr)
+  if (!page_addr || (*pte & PTE_U) == 0)
     return 0;
   return (void *)(page_addr + ((uint64)va & ((1 << PGSHIFT) - 1)));
 }
 
 //
 // maps virtual address [va, va+sz] to [pa, pa+sz] (for user application).
+// as user address spaces are tagged with ASIDs, the TLB is no longer flushed on every
+// trap, so each page table update of a user page is followed by a flush of that page.
 //
 void user_vm_map(pagetable_t page_dir, uint64 va, uint64 size, uint64 pa, int perm) {
   if (map_pages(page_dir, va, size, pa, perm) != 0) {
     panic("fail to user_vm_map .\n");
   }
+  for (uint64 off = 0; off < ROUNDUP(size, PGSIZE); off += PGSIZE) {
+    page_add_mapping((void *)(pa + off));
+    flush_tlb_page(va + off);
+  }
 }
 
 //
 // unmap virtual address [va, va+size] from the user app.
-// reclaim the physical pages if free!=0
+// drop the reference to the physical pages if free!=0, so that pages shared with other
+// processes are reclaimed only when the last of them unmaps the page.
 //
 void user_vm_unmap(pagetable_t page_dir, uint64 va, uint64 size, int free) {
   // TODO (lab2_2): implement user_vm_unmap to disable the mapping of the virtual pages
@@ -191,32 +276,231 @@ void user_vm_unmap(pagetable_t page_dir, uint64 va, uint64 size, int free) {
   if ((va % PGSIZE) != 0) panic("uvmunmap: not aligned");
 
   for (uint64 a = va; a < va + size; a += PGSIZE) {
-    if ((pte = page_walk(page_dir, a, 0)) == 0) panic("uvmunmap: walk");
-    if ((*pte & PTE_V) == 0) panic("uvmunmap: not mapped");
+    // pages of a demand-paged region that were never touched are not present
+    if ((pte = page_walk(page_dir, a, 0)) == 0 || (*pte & PTE_V) == 0) continue;
     if (PTE_FLAGS(*pte) == PTE_V) panic("uvmunmap: not a leaf");
-    if (free) {
-      uint64 pa = PTE2PA(*pte);
-      free_page((void *)pa);
-    }
+    uint64 pa = PTE2PA(*pte);
+    page_remove_mapping((void *)pa);
+    if (free) put_page((void *)pa);
     *pte = 0;
+    flush_tlb_page(a);
   }
 }
 
+//
+// share the user pages mapped at [va, va+size] in src_dir with dst_dir, copy-on-write:
+// writable pages become read-only in both page tables and are marked PTE_COW, so that
+// the first store from either side gets a private copy (see user_vm_cow_fault).
+// pages that are not present in src_dir are skipped.
+//
+void user_vm_share_cow(pagetable_t src_dir, pagetable_t dst_dir, uint64 va, uint64 size) {
+  pte_t *pte, *dst_pte;
+
+  for (uint64 a = ROUNDDOWN(va, PGSIZE); a < va + size; a += PGSIZE) {
+    if ((pte = page_walk(src_dir, a, 0)) == 0 || (*pte & PTE_V) == 0) continue;
+    if (*pte & PTE_W) {
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+      flush_tlb_page(a);
+    }
+
+    if ((dst_pte = page_walk(dst_dir, a, 1)) == 0) panic("user_vm_share_cow: walk");
+    if (*dst_pte & PTE_V) panic("user_vm_share_cow: remap of va (0x%lx)", a);
+    *dst_pte = *pte;
+
+    void *pa = (void *)PTE2PA(*pte);
+    get_page(pa);
+    page_add_mapping(pa);
+  }
+}
+
+//
+// resolve a store to the copy-on-write page at va of the address space mm. the last user
+// of the page simply gets it writable again, others get a private copy, which the threads
+// of mm on other harts must not miss.
+// returns 0 on success, -1 if va is not mapped by a copy-on-write page.
+//
+int user_vm_cow_fault(mm_struct *mm, uint64 va) {
+  pte_t *pte = page_walk(mm->pagetable, va, 0);
+  if (pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_COW) == 0) return -1;
+
+  void *pa = (void *)PTE2PA(*pte);
+  uint64 flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W | PTE_D;
+
+  if (pa_to_page(pa)->refcount == 1) {
+    *pte = PA2PTE(pa) | flags;
+    flush_tlb_page(va);
+    return 0;
+  }
+
+  void *copy = alloc_page();
+  if (copy == 0) panic("user_vm_cow_fault: out of memory.\n");
+  memcpy(copy, pa, PGSIZE);
+  *pte = PA2PTE(copy) | flags;
+  flush_tlb_page(va);
+  page_add_mapping(copy);
+  page_remove_mapping(pa);
+  put_page(pa);
+  smp_tlb_shootdown(mm);
+  return 0;
+}
+
+//
+// convert a user virtual address that the kernel is going to store into. a copy-on-write
+// page at va gets its private copy first, so the store does not leak into other processes.
+//
+void *user_va_to_pa_writable(mm_struct *mm, void *va) {
+  if ((uint64)va >= USER_STACK_TOP) return 0;
+  user_vm_cow_fault(mm, (uint64)va);
+
+  pte_t *pte = page_walk(mm->pagetable, (uint64)va, 0);
+  if (pte == 0 || (*pte & PTE_W) == 0) return 0;
+  return user_va_to_pa(mm->pagetable, va);
+}
+
+//
+// translate the user address va of process p for a load (or a store, if write) of the
+// kernel. a page of a demand-paged ELF segment that p has not touched yet is read in
+// first. returns 0 if va is not user memory of p, or not writable for a store.
+//
+void *user_va_access(process *p, uint64 va, int write) {
+  pagetable_t page_dir = p->mm->pagetable;
+  void *pa = write ? user_va_to_pa_writable(p->mm, (void *)va)
+                   : user_va_to_pa(page_dir, (void *)va);
+
+  if (pa == 0 && elf_demand_fault(p, va) == 0)
+    pa = write ? user_va_to_pa_writable(p->mm, (void *)va)
+               : user_va_to_pa(page_dir, (void *)va);
+  return pa;
+}
+
+//
+// copy len bytes from the user address src_va of process p to dst.
+// returns 0 on success, -1 if the range is not user memory of p.
+//
+int copyin(process *p, void *dst, uint64 src_va, uint64 len) {
+  while (len > 0) {
+    uint64 n = MIN(len, PGSIZE - (src_va & (PGSIZE - 1)));
+    void *pa = user_va_access(p, src_va, 0);
+    if (pa == 0) return -1;
+    memcpy(dst, pa, n);
+    dst += n;
+    src_va += n;
+    len -= n;
+  }
+  return 0;
+}
+
+//
+// copy len bytes from src to the user address dst_va of process p.
+// returns 0 on success, -1 if the range is not writable user memory of p.
+//
+int copyout(process *p, uint64 dst_va, const void *src, uint64 len) {
+  while (len > 0) {
+    uint64 n = MIN(len, PGSIZE - (dst_va & (PGSIZE - 1)));
+    void *pa = user_va_access(p, dst_va, 1);
+    if (pa == 0) return -1;
+    memcpy(pa, src, n);
+    src += n;
+    dst_va += n;
+    len -= n;
+  }
+  return 0;
+}
+
+//
+// copy the NUL-terminated string at the user address src_va of process p to dst, which
+// holds size bytes. returns the length of the string, or -1 if it is not user memory of
+// p or does not fit in dst.
+//
+int copyinstr(process *p, char *dst, uint64 src_va, uint64 size) {
+  for (uint64 i = 0; i < size;) {
+    char *pa = user_va_access(p, src_va + i, 0);
+    if (pa == 0) return -1;
+    // the rest of the page the string is in
+    for (uint64 n = PGSIZE - ((src_va + i) & (PGSIZE - 1)); n > 0 && i < size; n--, i++)
+      if ((dst[i] = *pa++) == 0) return i;
+  }
+  return -1;
+}
+
+/* --- address space identifiers --- */
+//
+// a process's asid value holds the generation it was handed out in above the hardware
+// ASID bits. ASIDs are handed out in increasing order; once a generation runs out, a new
+// one starts with a single full TLB flush, and processes holding an ASID of an older
+// generation get a new one the next time they run. ASID 0 belongs to the kernel.
+//
+static uint64 g_asid_bits;
+static uint64 g_asid_generation;
+static uint64 g_asid_next;
+
+#define ASID_MASK ((1UL << g_asid_bits) - 1)
+
+//
+// find out how many ASID bits the hart implements, by writing all ones to the ASID
+// field of satp and reading back the bits that stuck.
+//
+void asid_init(void) {
+  uint64 satp = read_csr(satp);
+  write_csr(satp, satp | SATP_ASID_MASK);
+  uint64 asids = (read_csr(satp) & SATP_ASID_MASK) >> SATP_ASID_SHIFT;
+  write_csr(satp, satp);
+
+  for (g_asid_bits = 0; asids & (1UL << g_asid_bits); g_asid_bits++)
+    ;
+  g_asid_generation = 1UL << g_asid_bits;
+  g_asid_next = 1;
+  sprint("ASID bits: %ld\n", g_asid_bits);
+}
+
+//
+// returns the hardware ASID for the address space whose asid value is *asid, handing out
+// a new one if it has none in the current generation. without ASIDs (g_asid_bits == 0),
+// every hand-out starts a new generation, so the TLB is flushed whenever a different
+// address space is switched to. the generation is shared by all harts: a new one makes
+// the other harts flush their TLBs before they next switch to a user address space.
+//
+uint64 asid_get(uint64 *asid) {
+  if (g_cpus[cpuid()].tlb_flush_pending) {
+    g_cpus[cpuid()].tlb_flush_pending = 0;
+    flush_tlb();
+  }
+  if ((*asid & ~ASID_MASK) == g_asid_generation) return *asid & ASID_MASK;
+
+  if (g_asid_next > ASID_MASK) {
+    g_asid_generation += 1UL << g_asid_bits;
+    g_asid_next = 1;
+    for (int i = 0; i < NCPU; i++) g_cpus[i].tlb_flush_pending = (i != cpuid());
+    flush_tlb();
+  }
+  *asid = g_asid_generation | (g_asid_next++ & ASID_MASK);
+  return *asid & ASID_MASK;
+}
+
+//
+// drop the translations of an address space that is torn down (or rebuilt by exec),
+// so that its ASID can keep being used.
+//
+void asid_flush(uint64 asid) {
+  if ((asid & ~ASID_MASK) == g_asid_generation) flush_tlb_asid(asid & ASID_MASK);
+}
+
 //
 // debug function, print the vm space of a process.
 //
 void print_proc_vmspace(process* proc) {
   sprint( "======\tbelow is the vm space of process%d\t========\n", proc->pid );
-  for( int i=0; i<proc->total_mapped_region; i++ ){
-    sprint( "-va:%lx, npage:%d, ", proc->mapped_info[i].va, proc->mapped_info[i].npages);
-    switch(proc->mapped_info[i].seg_type){
+  for( int i=0; i<proc->mm->total_mapped_region; i++ ){
+    sprint( "-va:%lx, npage:%d, ", proc->mm->mapped_info[i].va, proc->mm->mapped_info[i].npages);
+    switch(proc->mm->mapped_info[i].seg_type){
       case CODE_SEGMENT: sprint( "type: CODE SEGMENT" ); break;
       case DATA_SEGMENT: sprint( "type: DATA SEGMENT" ); break;
       case STACK_SEGMENT: sprint( "type: STACK SEGMENT" ); break;
       case CONTEXT_SEGMENT: sprint( "type: TRAPFRAME SEGMENT" ); break;
       case SYSTEM_SEGMENT: sprint( "type: USER KERNEL STACK SEGMENT" ); break;
+      case RING_SEGMENT: sprint( "type: SYSCALL RING SEGMENT" ); break;
     }
-    sprint( ", mapped to pa:%lx\n", lookup_pa(proc->pagetable, proc->mapped_info[i].va) );
+    sprint( ", mapped to pa:%lx\n", lookup_pa(proc->mm->pagetable, proc->mm->mapped_info[i].va) );
   }
 
 }
@@ -26,12 +26,26 @@ void kern_vm_map(pagetable_t page_dir, uint64 va, uint64 pa, uint64 sz, int perm
 
 // Initialize the kernel pagetable
 void kern_vm_init(void);
+void kern_vm_switch(void);
 
 /* --- user page table --- */
 void *user_va_to_pa(pagetable_t page_dir, void *va);
+void user_vm_map_kernel(pagetable_t page_dir);
 void user_vm_map(pagetable_t page_dir, uint64 va, uint64 size, uint64 pa, int perm);
 void user_vm_unmap(pagetable_t page_dir, uint64 va, uint64 size, int free);
 void *user_va_to_pa(pagetable_t page_dir, void *va);
+void *user_va_to_pa_writable(mm_struct *mm, void *va);
+void user_vm_share_cow(pagetable_t src_dir, pagetable_t dst_dir, uint64 va, uint64 size);
+int user_vm_cow_fault(mm_struct *mm, uint64 va);
+void *user_va_access(process *p, uint64 va, int write);
+int copyin(process *p, void *dst, uint64 src_va, uint64 len);
+int copyout(process *p, uint64 dst_va, const void *src, uint64 len);
+int copyinstr(process *p, char *dst, uint64 src_va, uint64 size);
+
+/* --- address space identifiers --- */
+void asid_init(void);
+uint64 asid_get(uint64 *asid);
+void asid_flush(uint64 asid);
 void print_proc_vmspace(process* proc);
 
 #endif
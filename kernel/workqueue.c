@@ -0,0 +1,44 @@
+/*
+ * deferred work, for what the kernel need not do on the path of a syscall or trap. the
+ * kernel is stackless: it has no context of its own to switch to, so instead of worker
+ * threads, the harts are the workers. a hart runs the queued work when it has no process
+ * to run (sched_idle), and one item at each timer tick, so that the work cannot starve
+ * while all harts are busy. like the rest of the kernel, it runs under the kernel lock.
+ */
+
+#include "workqueue.h"
+#include "util/types.h"
+
+// FIFO of the queued work
+static work_struct *g_work_head, *g_work_tail;
+
+//
+// queue work to run fn(arg) later.
+//
+void queue_work(work_struct *work, void (*fn)(void *), void *arg) {
+  work->fn = fn;
+  work->arg = arg;
+  work->next = NULL;
+  if (g_work_tail)
+    g_work_tail->next = work;
+  else
+    g_work_head = work;
+  g_work_tail = work;
+}
+
+//
+// run up to max items of the queued work (all of it if max is negative). returns the
+// number of items run.
+//
+int run_work(int max) {
+  int n = 0;
+  while (g_work_head && (max < 0 || n < max)) {
+    work_struct *work = g_work_head;
+    g_work_head = work->next;
+    if (g_work_head == NULL) g_work_tail = NULL;
+    // fn may free the work_struct, or queue it again
+    work->fn(work->arg);
+    n++;
+  }
+  return n;
+}
@@ -0,0 +1,15 @@
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+// a piece of deferred work, fn(arg) runs later in the kernel (see workqueue.c). the
+// work_struct belongs to the caller, and must stay valid until fn runs.
+typedef struct work_struct {
+  void (*fn)(void *arg);
+  void *arg;
+  struct work_struct *next;
+} work_struct;
+
+void queue_work(work_struct *work, void (*fn)(void *), void *arg);
+int run_work(int max);
+
+#endif
@@ -5,10 +5,20 @@
 #ifndef _RISCV_ATOMIC_H_
 #define _RISCV_ATOMIC_H_
 
-// Currently, interrupts are always disabled in M-mode.
-// todo: for PKE, wo turn on irq in lab_1_3_timer, so wo have to implement these two functions.
-#define disable_irqsave() (0)
-#define enable_irqrestore(flags) ((void)(flags))
+// the locks below are taken in both M-mode (m_start, M-mode traps) and S-mode. M-mode
+// interrupts are off while we run there, so only the S-mode ones (sstatus.SIE) need to be
+// masked, and M-mode may access sstatus as well.
+#define SSTATUS_SIE_BIT 2
+
+static inline long disable_irqsave(void) {
+  long flags;
+  asm volatile("csrrci %0, sstatus, %1" : "=r"(flags) : "i"(SSTATUS_SIE_BIT) : "memory");
+  return flags & SSTATUS_SIE_BIT;
+}
+
+static inline void enable_irqrestore(long flags) {
+  if (flags) asm volatile("csrs sstatus, %0" : : "r"(flags) : "memory");
+}
 
 typedef struct {
   int lock;
@@ -24,6 +34,15 @@ typedef struct {
 #define atomic_set(ptr, val) (*(volatile typeof(*(ptr))*)(ptr) = val)
 #define atomic_read(ptr) (*(volatile typeof(*(ptr))*)(ptr))
 
+#ifdef __riscv_atomic
+// with the A extension, these compile to amoadd/amoor/amoswap and an lr/sc loop (cas),
+// all with acquire and release ordering. each returns the previous value of *ptr.
+#define atomic_add(ptr, inc) __atomic_fetch_add(ptr, inc, __ATOMIC_SEQ_CST)
+#define atomic_or(ptr, inc) __atomic_fetch_or(ptr, inc, __ATOMIC_SEQ_CST)
+#define atomic_swap(ptr, swp) __atomic_exchange_n(ptr, swp, __ATOMIC_SEQ_CST)
+#define atomic_cas(ptr, cmp, swp) __sync_val_compare_and_swap(ptr, cmp, swp)
+#else
+// without it, fall back to read-modify-write with interrupts off: atomic on one hart only
 #define atomic_binop(ptr, inc, op)         \
   ({                                       \
     long flags = disable_irqsave();        \
@@ -43,6 +62,7 @@ typedef struct {
     enable_irqrestore(flags);                               \
     res;                                                    \
   })
+#endif
 
 static inline int spinlock_trylock(spinlock_t* lock) {
   int res = atomic_swap(&lock->lock, -1);
@@ -73,4 +93,100 @@ static inline void spinlock_unlock_irqrestore(spinlock_t* lock, long flags) {
   enable_irqrestore(flags);
 }
 
+//
+// ticket lock: harts are served in the order they arrive. both counters are only
+// updated by the lock holder.
+//
+typedef struct {
+  unsigned int next;   // next ticket to hand out
+  unsigned int owner;  // ticket being served
+  unsigned long acquired;
+  unsigned long contended;  // acquisitions that had to wait
+} ticket_lock_t;
+
+#define TICKET_LOCK_INIT \
+  { 0, 0, 0, 0 }
+
+static inline void ticket_lock(ticket_lock_t* lock) {
+  unsigned int ticket = atomic_add(&lock->next, 1);
+  int waited = 0;
+  while (atomic_read(&lock->owner) != ticket) waited = 1;
+  mb();
+
+  lock->acquired++;
+  lock->contended += waited;
+}
+
+static inline void ticket_unlock(ticket_lock_t* lock) {
+  mb();
+  atomic_set(&lock->owner, lock->owner + 1);
+}
+
+static inline long ticket_lock_irqsave(ticket_lock_t* lock) {
+  long flags = disable_irqsave();
+  ticket_lock(lock);
+  return flags;
+}
+
+static inline void ticket_unlock_irqrestore(ticket_lock_t* lock, long flags) {
+  ticket_unlock(lock);
+  enable_irqrestore(flags);
+}
+
+//
+// MCS queue lock: each waiter spins on its own node instead of the shared lock word,
+// so a contended lock does not bounce between harts. the node passed to mcs_unlock must
+// be the one passed to mcs_lock.
+//
+typedef struct mcs_node {
+  struct mcs_node* next;
+  int locked;
+} mcs_node_t;
+
+typedef struct {
+  mcs_node_t* tail;  // last waiter, NULL if the lock is free
+  unsigned long acquired;
+  unsigned long contended;  // acquisitions that had to wait
+} mcs_lock_t;
+
+#define MCS_LOCK_INIT \
+  { 0, 0, 0 }
+
+static inline void mcs_lock(mcs_lock_t* lock, mcs_node_t* node) {
+  node->next = 0;
+  node->locked = 1;
+  mcs_node_t* prev = atomic_swap(&lock->tail, node);
+  if (prev) {
+    atomic_set(&prev->next, node);
+    while (atomic_read(&node->locked))
+      ;
+  }
+  mb();
+
+  lock->acquired++;
+  lock->contended += (prev != 0);
+}
+
+static inline void mcs_unlock(mcs_lock_t* lock, mcs_node_t* node) {
+  mb();
+  if (atomic_read(&node->next) == 0) {
+    // no known successor: free the lock, unless one is just queueing up behind us
+    if (atomic_cas(&lock->tail, node, (mcs_node_t*)0) == node) return;
+    while (atomic_read(&node->next) == 0)
+      ;
+  }
+  atomic_set(&node->next->locked, 0);
+}
+
+static inline long mcs_lock_irqsave(mcs_lock_t* lock, mcs_node_t* node) {
+  long flags = disable_irqsave();
+  mcs_lock(lock, node);
+  return flags;
+}
+
+static inline void mcs_unlock_irqrestore(mcs_lock_t* lock, mcs_node_t* node, long flags) {
+  mcs_unlock(lock, node);
+  enable_irqrestore(flags);
+}
+
 #endif
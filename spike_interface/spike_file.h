@@ -61,6 +61,7 @@ ssize_t spike_file_read(spike_file_t* f, void* buf, size_t size);
 ssize_t spike_file_pread(spike_file_t* f, void* buf, size_t n, off_t off);
 ssize_t spike_file_write(spike_file_t* f, const void* buf, size_t n);
 void spike_file_decref(spike_file_t* f);
+void spike_file_incref(spike_file_t* f);
 void spike_file_init(void);
 int spike_file_dup(spike_file_t* f);
 int spike_file_truncate(spike_file_t* f, off_t len);
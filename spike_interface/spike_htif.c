@@ -70,7 +70,7 @@ extern uint64_t __htif_base;
 #define FROMHOST_OFFSET ((uint64)fromhost - (uint64)__htif_base)
 
 volatile int htif_console_buf;
-static spinlock_t htif_lock = SPINLOCK_INIT;
+static ticket_lock_t htif_lock = TICKET_LOCK_INIT;
 
 static void __check_fromhost(void) {
   uint64_t fh = fromhost;
@@ -96,7 +96,7 @@ static void __set_tohost(uint64 dev, uint64 cmd, uint64 data) {
 }
 
 static void do_tohost_fromhost(uint64 dev, uint64 cmd, uint64 data) {
-  spinlock_lock(&htif_lock);
+  long flags = ticket_lock_irqsave(&htif_lock);
   __set_tohost(dev, cmd, data);
 
   while (1) {
@@ -109,7 +109,7 @@ static void do_tohost_fromhost(uint64 dev, uint64 cmd, uint64 data) {
       __check_fromhost();
     }
   }
-  spinlock_unlock(&htif_lock);
+  ticket_unlock_irqrestore(&htif_lock, flags);
 }
 
 /////////////////////    Encapsulated Spike HTIF functionalities    //////////////////
@@ -126,9 +126,9 @@ void htif_console_putchar(uint8_t ch) {
   magic_mem[3] = 1;
   do_tohost_fromhost(0, 0, (uint64)magic_mem);
 #else
-  spinlock_lock(&htif_lock);
+  long flags = ticket_lock_irqsave(&htif_lock);
   __set_tohost(1, 1, ch);
-  spinlock_unlock(&htif_lock);
+  ticket_unlock_irqrestore(&htif_lock, flags);
 #endif
 }
 
@@ -138,14 +138,14 @@ int htif_console_getchar(void) {
   return -1;
 #endif
 
-  spinlock_lock(&htif_lock);
+  long flags = ticket_lock_irqsave(&htif_lock);
   __check_fromhost();
   int ch = htif_console_buf;
   if (ch >= 0) {
     htif_console_buf = -1;
     __set_tohost(1, 0, 0);
   }
-  spinlock_unlock(&htif_lock);
+  ticket_unlock_irqrestore(&htif_lock, flags);
 
   return ch - 1;
 }
@@ -16,8 +16,8 @@ long frontend_syscall(long n, uint64 a0, uint64 a1, uint64 a2, uint64 a3, uint64
       uint64 a5, uint64 a6) {
   static volatile uint64 magic_mem[8];
 
-  static spinlock_t lock = SPINLOCK_INIT;
-  spinlock_lock(&lock);
+  static ticket_lock_t lock = TICKET_LOCK_INIT;
+  long flags = ticket_lock_irqsave(&lock);
 
   magic_mem[0] = n;
   magic_mem[1] = a0;
@@ -32,7 +32,7 @@ long frontend_syscall(long n, uint64 a0, uint64 a1, uint64 a2, uint64 a3, uint64
 
   long ret = magic_mem[0];
 
-  spinlock_unlock(&lock);
+  ticket_unlock_irqrestore(&lock, flags);
   return ret;
 }
 
@@ -0,0 +1,53 @@
+/*
+ * measures the cost of a null syscall (getpid) and of a context switch (a yield between
+ * a parent and its forked child), in cycles and in timer (mtime) ticks.
+ */
+
+#include "user_lib.h"
+#include "util/types.h"
+
+#define ROUNDS 1000
+
+static inline uint64 rdcycle() {
+  uint64 x;
+  asm volatile("rdcycle %0" : "=r"(x));
+  return x;
+}
+
+static inline uint64 rdtime() {
+  uint64 x;
+  asm volatile("rdtime %0" : "=r"(x));
+  return x;
+}
+
+int main(int argc, char *argv[]){
+  printu("===== bench =====\n");
+
+  // null syscall
+  uint64 cycle = rdcycle(), time = rdtime();
+  for ( int i = 0; i < ROUNDS; ++ i )
+    getpid();
+  cycle = rdcycle() - cycle;
+  time = rdtime() - time;
+  printu("syscall: %ld cycles, %ld ticks per call\n", (long)(cycle / ROUNDS),
+    (long)(time / ROUNDS));
+
+  // context switch: parent and child yield to each other, two switches per round
+  int pid = fork();
+  if ( pid == 0 ){
+    for ( int i = 0; i < ROUNDS; ++ i )
+      yield();
+    exit(0);
+  }
+  cycle = rdcycle(), time = rdtime();
+  for ( int i = 0; i < ROUNDS; ++ i )
+    yield();
+  cycle = rdcycle() - cycle;
+  time = rdtime() - time;
+  printu("context switch: %ld cycles, %ld ticks per switch\n", (long)(cycle / (2 * ROUNDS)),
+    (long)(time / (2 * ROUNDS)));
+
+  wait(pid);
+  exit(0);
+  return 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * checks that the floating-point state of a process survives context switches (see
+ * kernel/fp.c): more processes than harts compute FP sums in loops long enough to be
+ * preempted, and yield between them, each with FP registers of its own values.
+ */
+
+#include "user_lib.h"
+#include "util/types.h"
+
+#define NPROCS 6
+#define ROUNDS 8
+#define STEPS (1 << 20)
+
+// sum of i * k for i < STEPS, in doubles: exact, as it stays far below 2^53
+static double fp_sum(double k) {
+  double sum = 0, x = 0;
+  for ( int i = 0; i < STEPS; ++ i ){
+    sum += x * k;
+    x += 1.0;
+  }
+  return sum;
+}
+
+// returns the number of rounds that got a wrong sum
+static int fp_run(int k) {
+  double expect = (double)k * (STEPS / 2) * (STEPS - 1);
+  int bad = 0;
+  for ( int r = 0; r < ROUNDS; ++ r ){
+    if ( fp_sum(k) != expect ) bad++;
+    yield();
+  }
+  return bad;
+}
+
+int main(int argc, char *argv[]){
+  printu("===== fptest =====\n");
+
+  int k = 1;
+  for ( int i = 1; i < NPROCS; ++ i )
+    if ( fork() == 0 ){
+      k = i + 1;
+      break;
+    }
+
+  int bad = fp_run(k);
+  printu("fptest %d: %d of %d rounds wrong\n", k, bad, ROUNDS);
+
+  if ( k == 1 )
+    for ( int i = 1; i < NPROCS; ++ i )
+      wait(-1);
+  exit(bad != 0);
+  return 0;
+}
@@ -29,42 +29,47 @@ struct execcmd {
 };
 
 
-void panic(char *);
 struct cmd * parsecmd(char *);
 
 //
-// Fork a child process to run the input command.
+// Spawn a child process to run the input command. returns its pid, or -1 if there is
+// nothing to run.
 // 
-void runcmd(struct cmd * cmd){
+int spawncmd(struct cmd * cmd){
   struct execcmd * ecmd;
+  int pid;
 
   if ( cmd == NULL )
-    exit(0);
+    return -1;
 
   switch (cmd->type){
   case EXEC:
     ecmd = (struct execcmd *)cmd;
     if ( ecmd->argv[0] == 0 )
-      exit(0);
+      return -1;
     int i = 0;
     while ( ecmd->argv[i] ){
       printu("argv[%d]=%s\n",i, ecmd->argv[i]);
       ++ i;
     }
-    exec(ecmd->argv[0], ecmd->argv);
-    printu("exec %s failed\n", ecmd->argv[0]);
-    break;
+    pid = spawn(ecmd->argv[0], ecmd->argv);
+    if ( pid < 0 )
+      printu("spawn %s failed\n", ecmd->argv[0]);
+    return pid;
 
   default:
-    panic("Unknown command!\n");
-    break;
+    printu("Unknown command!\n");
+    return -1;
   }
-  exit(0);
 }
 
-void panic(char * s){
+//
+// report a malformed command line. the shell itself parses it now, so this does not exit.
+//
+struct cmd * syntax(struct cmd * cmd, char * s){
   printu("%s\n", s);
-  exit(-1);
+  naive_free(cmd);
+  return NULL;
 }
 
 //
@@ -147,10 +152,12 @@ struct cmd * parsecmd(char * s){
   
   es = s + strlen(s);
   cmd = parseline(&s, es);
+  if ( cmd == NULL )
+    return NULL;
   peek(&s, es, "");
   if ( s != es ){
     printu("leftovers: %s\n", s);
-    panic("syntax");
+    return syntax(cmd, "syntax");
   }
   nulterminate(cmd);
   // cmd done
@@ -185,11 +192,11 @@ struct cmd * parseexec(char ** ps, char * es){
     if ( (tok = gettoken(ps, es, &q, &eq)) == 0 )
       break;
     if ( tok != 'a' )
-      panic("syntax");
+      return syntax(ret, "syntax");
     cmd->argv[argc] = q;
     cmd->eargv[argc++] = eq;
     if ( argc >= MAXARGS )
-      panic("too many args");
+      return syntax(ret, "too many args");
   }
   cmd->argv[argc] = 0;
   cmd->eargv[argc] = 0;
@@ -237,12 +244,13 @@ void mysh(){
     if ( isExit(buf) == 1 ) // exit
       break;
 
-    int rc = fork();
-    if ( rc == 0 ){ // child
-      runcmd(parsecmd(buf));
-    }else{
-      wait(-1);
-    }
+    // one syscall builds the child from the command, with no address space to copy
+    struct cmd * cmd = parsecmd(buf);
+    int pid = spawncmd(cmd);
+    if ( pid > 0 )
+      wait(pid);
+    if ( cmd != NULL )
+      naive_free(cmd);
   }
   return;
 }
\ No newline at end of file
@@ -1,10 +1,64 @@
 #include "user_lib.h"
 #include "util/types.h"
+#include "util/string.h"
+
+// shows the kernel statistics, read from the kernel info page with no syscall (see
+// kinfo_read), and the syscall statistics
+
+// one letter for each process status shown
+static const char status_char[] = {
+  [KINFO_READY] = 'S', [KINFO_RUNNING] = 'R', [KINFO_BLOCKED] = 'B', [KINFO_ZOMBIE] = 'Z',
+};
+
+static kinfo info;
+static syscall_stat stats[64];
 
 int main(int argc, char *argv[]){
   printu("===== top =====\n");
 
-  getinfo();
+  kinfo_read(&info);
+
+  printu("top - up %ld ms\n", info.mtime / (info.timebase_freq / 1000));
+  printu("Tasks: %d total, %d ready, %d running, %d blocked, %d zombie\n",
+    info.nr_ready + info.nr_running + info.nr_blocked + info.nr_zombie, info.nr_ready,
+    info.nr_running, info.nr_blocked, info.nr_zombie);
+  printu("Cpu(s): %ld ticks\n", info.ticks);
+  printu("Sched: %s, %ld context switches\n", info.sched_policy, info.nr_switches);
+  printu("KiB Mem: %ld\n", info.mem_size >> 10);
+
+  // the share of the CPU each runnable process is entitled to, by its weight
+  int total_weight = 0;
+  for (int i = 0; i < info.nproc; i++)
+    if (info.procs[i].status == KINFO_READY || info.procs[i].status == KINFO_RUNNING)
+      total_weight += info.procs[i].weight;
+
+  // SHARE and CPU are in percent: entitled by weight, and actually used so far
+  printu("\nPID\tS\tNI\tSHARE\tCPU\tHART\tMEM\tTICK\n");
+  for (int i = 0; i < info.nproc; i++) {
+    kinfo_proc* p = &info.procs[i];
+    if (p->status == KINFO_FREE) continue;
+
+    char stat = status_char[p->status];
+    int runnable = p->status == KINFO_READY || p->status == KINFO_RUNNING;
+    int share = runnable ? p->weight * 100 / total_weight : 0;
+    int cpu = info.ticks ? p->ticks * 100 / info.ticks : 0;
+    printu("%ld\t%c\t%d\t%d\t%d\t%d\t%ld\t%ld\n", p->pid, stat, p->nice, share, cpu,
+      p->cpu, p->mem * 4, p->ticks);
+  }
+
+  // calls, average cycles per returning call, and the log2 latency histogram (bucket:count,
+  // a call in bucket i took [2^i, 2^(i+1)) cycles)
+  int n = syscall_stats(stats, 64);
+  printu("\nSYSCALL\t\tCALLS\tAVG\tHISTOGRAM\n");
+  for (int i = 0; i < n; i++) {
+    syscall_stat* st = &stats[i];
+    if (st->calls == 0) continue;
+    printu("%s\t%s%ld\t%ld\t", st->name, strlen(st->name) < 8 ? "\t" : "", st->calls,
+      st->returns ? st->cycles / st->returns : 0);
+    for (int b = 0; b < SYSCALL_HIST_BUCKETS; b++)
+      if (st->hist[b]) printu(" %d:%ld", b, st->hist[b]);
+    printu("\n");
+  }
 
   exit(0);
   return 0;
@@ -9,6 +9,7 @@
 #include "util/types.h"
 #include "util/snprintf.h"
 #include "kernel/syscall.h"
+#include "kernel/memlayout.h"
 
 uint64 do_user_call(uint64 sysnum, uint64 a1, uint64 a2, uint64 a3, uint64 a4, uint64 a5, uint64 a6,
                  uint64 a7) {
@@ -64,6 +65,50 @@ void naive_free(void* va) {
   do_user_call(SYS_user_free_page, (uint64)va, 0, 0, 0, 0, 0, 0);
 }
 
+//
+// lib call to sbrk, moves the end of the heap. returns the previous end.
+//
+void* sbrk(int64 increment) {
+  return (void*)do_user_call(SYS_user_sbrk, increment, 0, 0, 0, 0, 0, 0);
+}
+
+//
+// lib call to mmap, maps length bytes of zeroed memory in a single call
+//
+void* mmap(uint64 length) {
+  return (void*)do_user_call(SYS_user_mmap, length, 0, 0, 0, 0, 0, 0);
+}
+
+//
+// lib call to munmap
+//
+int munmap(void* addr, uint64 length) {
+  return do_user_call(SYS_user_munmap, (uint64)addr, length, 0, 0, 0, 0, 0);
+}
+
+//
+// lib call to getpid
+//
+int getpid() {
+  return do_user_call(SYS_user_getpid, 0, 0, 0, 0, 0, 0, 0);
+}
+
+//
+// lib call to setpriority, sets the nice value of process pid (-1 for the caller)
+//
+int setpriority(int pid, int nice) {
+  return do_user_call(SYS_user_setpriority, pid, nice, 0, 0, 0, 0, 0);
+}
+
+//
+// lib call to nanosleep: block for (at least) ns nanoseconds
+//
+int nanosleep(uint64 ns) {
+  return do_user_call(SYS_user_nanosleep, ns, 0, 0, 0, 0, 0, 0);
+}
+
+int sleep_ms(uint64 ms) { return nanosleep(ms * 1000000); }
+
 //
 // lib call to naive_fork
 int fork() {
@@ -77,18 +122,37 @@ void yield() {
   do_user_call(SYS_user_yield, 0, 0, 0, 0, 0, 0, 0);
 }
 
+//
+// a thread starts here, and exits when fn returns
+//
+static void thread_start(void (*fn)(void *), void *arg) {
+  fn(arg);
+  exit(0);
+}
+
+//
+// start a thread running fn(arg) on the given stack, in the address space of the process.
+// returns its thread id, to be passed to thread_join.
+//
+int thread_create(void (*fn)(void *), void *arg, void *stack, uint64 stack_size) {
+  uint64 top = ((uint64)stack + stack_size) & ~15UL;
+  return do_user_call(SYS_user_clone, (uint64)thread_start, (uint64)fn, (uint64)arg, top, 0,
+                      0, 0);
+}
+
+//
+// wait for the thread tid to exit. returns tid, or -1 if there is no such thread.
+//
+int thread_join(int tid) {
+  return do_user_call(SYS_user_thread_join, tid, 0, 0, 0, 0, 0, 0);
+}
+
 //
 // lab3_challenge1
 //
 int wait(int pid){
-  int ret = -1;
-  while (1){
-    ret = do_user_call(SYS_user_wait, pid, 0, 0, 0, 0, 0, 0);
-    if ( ret == -2 )  // waiting
-      yield();
-    else
-      return ret;
-  }
+  // blocks in the kernel until a child (pid, or any if pid is -1) exits
+  return do_user_call(SYS_user_wait, pid, 0, 0, 0, 0, 0, 0);
 }
 
 //
@@ -105,6 +169,14 @@ int exec(char * path, char ** argv){
   return do_user_call(SYS_user_exec, (uint64)path, (uint64)argv, 0, 0, 0, 0, 0);
 }
 
+//
+// lib call to spawn: start the command argv as a child process, as fork followed by
+// exec in the child would. returns the pid of the child, or -1.
+//
+int spawn(char * path, char ** argv){
+  return do_user_call(SYS_user_spawn, (uint64)path, (uint64)argv, 0, 0, 0, 0, 0);
+}
+
 //
 // lib call to open
 //
@@ -145,4 +217,86 @@ int close(int fd) {
 //
 int getinfo(){
   return do_user_call(SYS_user_getinfo, 0, 0, 0, 0, 0, 0, 0);
+}
+
+//
+// lib call to syscall_stats: copy the statistics of the first n syscalls (by number) to
+// buf, returns how many were copied
+//
+int syscall_stats(syscall_stat* buf, int n){
+  return do_user_call(SYS_user_syscall_stats, (uint64)buf, n, 0, 0, 0, 0, 0);
+}
+
+//
+// copy the kernel info page (see kernel/kinfo.h) to out, without a syscall. the page is
+// mapped read-only at USER_KINFO_VA in every process, and guarded by a seqlock: copy it
+// while no update is under way, and again if one has happened meanwhile.
+//
+int kinfo_read(kinfo* out){
+  const volatile kinfo* k = (const volatile kinfo*)USER_KINFO_VA;
+  const volatile uint64* src = (const volatile uint64*)k;
+  uint64* dst = (uint64*)out;
+  uint64 seq;
+
+  do {
+    while ((seq = k->seq) & 1)
+      ;
+    __sync_synchronize();
+    for (int i = 0; i < sizeof(kinfo) / sizeof(uint64); i++) dst[i] = src[i];
+    __sync_synchronize();
+  } while (k->seq != seq);
+
+  return 0;
+}
+
+//
+// the syscall rings of this process (see kernel/syscall_ring.h), once ring_setup is done
+//
+static volatile syscall_ring* g_ring = NULL;
+
+int ring_setup(){
+  uint64 va = do_user_call(SYS_user_ring_setup, 0, 0, 0, 0, 0, 0, 0);
+  if (va == 0) return -1;
+  g_ring = (volatile syscall_ring*)va;
+  return 0;
+}
+
+//
+// queue syscall opcode with its arguments, tagged with user_data. returns -1 if the
+// submission ring is full.
+//
+int ring_queue(uint64 opcode, uint64 a1, uint64 a2, uint64 a3, uint64 user_data){
+  if (g_ring->sq_tail - g_ring->sq_head >= RING_ENTRIES) return -1;
+
+  volatile ring_sqe* sqe = &g_ring->sq[g_ring->sq_tail % RING_ENTRIES];
+  sqe->opcode = opcode;
+  sqe->args[0] = a1;
+  sqe->args[1] = a2;
+  sqe->args[2] = a3;
+  sqe->user_data = user_data;
+  // the entry is complete before the kernel may see it
+  __sync_synchronize();
+  g_ring->sq_tail++;
+  return 0;
+}
+
+//
+// have the kernel run the queued syscalls, with a single trap. returns how many it ran.
+//
+int ring_enter(){
+  return do_user_call(SYS_user_ring_enter, 0, 0, 0, 0, 0, 0, 0);
+}
+
+//
+// take the next result out of the completion ring. returns 0 if there is none.
+//
+int ring_reap(int64* result, uint64* user_data){
+  if (g_ring->cq_head == g_ring->cq_tail) return 0;
+  __sync_synchronize();
+
+  volatile ring_cqe* cqe = &g_ring->cq[g_ring->cq_head % RING_ENTRIES];
+  *result = cqe->result;
+  *user_data = cqe->user_data;
+  g_ring->cq_head++;
+  return 1;
 }
\ No newline at end of file
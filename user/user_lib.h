@@ -3,17 +3,38 @@
  */
 
 #include "util/types.h"
+#include "kernel/kinfo.h"
+#include "kernel/syscall_ring.h"
+#include "kernel/syscall.h"
 
 int printu(const char *s, ...);
 int exit(int code);
 void* naive_malloc();
 void naive_free(void* va);
+void* sbrk(int64 increment);
+void* mmap(uint64 length);
+int munmap(void* addr, uint64 length);
 int fork();
+int getpid();
+int setpriority(int pid, int nice);
+int nanosleep(uint64 ns);
+int sleep_ms(uint64 ms);
 int wait(int pid);
+int thread_create(void (*fn)(void *), void *arg, void *stack, uint64 stack_size);
+int thread_join(int tid);
 void yield();
 int getlineu(char * dst, int size);
 int exec(char * path, char ** argv);
+int spawn(char * path, char ** argv);
 int getinfo();
+int syscall_stats(syscall_stat* buf, int n);
+int kinfo_read(kinfo* out);
+
+// syscall rings
+int ring_setup();
+int ring_queue(uint64 opcode, uint64 a1, uint64 a2, uint64 a3, uint64 user_data);
+int ring_enter();
+int ring_reap(int64* result, uint64* user_data);
 
 // file
 int open(const char *pathname, int flags);